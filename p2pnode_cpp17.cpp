@@ -6,13 +6,41 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <deque>
 #include <thread>
 #include <filesystem>
 #include <cstdio>
 #include <cstdlib>
+#include <cctype>
+#include <cerrno>
+#include <climits>
 #include <mutex>
 #include <fstream>
-
+#include <sstream>
+#include <set>
+#include <chrono>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <array>
+#include <cstring>
+#include <unordered_set>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/syscall.h>
+#include <signal.h>
+#include <linux/futex.h>
+
+// 배치/병렬 전송 때 데이터 서버로 연결이 한꺼번에 몰리므로 기본 listen backlog(5)를 늘린다.
+// (backlog 초과 시 SYN 이 버려져 클라이언트가 1초 뒤 재시도하게 됨)
+#define CPPHTTPLIB_LISTEN_BACKLOG 128
 #include "httplib.h"
 #include "json.hpp"
 
@@ -30,6 +58,48 @@ bool ends_with(const std::string &s, const std::string &suffix) {
            std::equal(suffix.rbegin(), suffix.rend(), s.rbegin());
 }
 
+// "a,b,c" → {"a","b","c"} (빈 항목은 버림)
+std::vector<std::string> split_list(const std::string &s, char sep = ',') {
+    std::vector<std::string> out;
+    std::size_t start = 0;
+    while (start <= s.size()) {
+        std::size_t end = s.find(sep, start);
+        if (end == std::string::npos) end = s.size();
+        if (end > start) out.push_back(s.substr(start, end - start));
+        start = end + 1;
+    }
+    return out;
+}
+
+// "64K", "10M", "2G" 같은 크기 표기 → 바이트. 접미사 없으면 바이트.
+uint64_t parse_size(const std::string &s) {
+    if (s.empty()) return 0;
+    std::size_t idx = 0;
+    double v = std::stod(s, &idx);
+    std::string unit = s.substr(idx);
+    uint64_t mul = 1;
+    if (!unit.empty()) {
+        char u = (char)std::toupper((unsigned char)unit[0]);
+        if (u == 'K') mul = 1ULL << 10;
+        else if (u == 'M') mul = 1ULL << 20;
+        else if (u == 'G') mul = 1ULL << 30;
+        else if (u == 'T') mul = 1ULL << 40;
+        else if (u != 'B') throw std::invalid_argument("invalid size: " + s);
+    }
+    return v <= 0 ? 0 : (uint64_t)(v * (double)mul);
+}
+
+// little-endian 정수 인코딩 (bundle / manifest 프레임용)
+void put_le(std::string &out, uint64_t v, int bytes) {
+    for (int i = 0; i < bytes; ++i) out.push_back((char)((v >> (8 * i)) & 0xff));
+}
+
+uint64_t get_le(const unsigned char *p, int bytes) {
+    uint64_t v = 0;
+    for (int i = 0; i < bytes; ++i) v |= (uint64_t)p[i] << (8 * i);
+    return v;
+}
+
 // ---------------- fs helpers ----------------
 bool file_exists(const fs::path &p) {
     std::error_code ec;
@@ -43,6 +113,40 @@ void ensure_dir(const fs::path &p) {
     }
 }
 
+// 전송 바이트 추정 (스케줄러 진입용). 폴더는 하위 일반 파일 크기 합.
+uint64_t estimate_transfer_bytes(const fs::path &p) {
+    std::error_code ec;
+    if (fs::is_regular_file(p, ec)) {
+        auto sz = fs::file_size(p, ec);
+        return ec ? 0 : (uint64_t)sz;
+    }
+    uint64_t total = 0;
+    fs::recursive_directory_iterator it(p, fs::directory_options::skip_permission_denied, ec), end;
+    for (; !ec && it != end; it.increment(ec)) {
+        std::error_code ec2;
+        if (!it->is_regular_file(ec2)) continue;
+        auto sz = it->file_size(ec2);
+        if (!ec2) total += (uint64_t)sz;
+    }
+    return total;
+}
+
+// stat 의 mtime 을 ns 단위로
+int64_t stat_mtime_ns(const struct stat &st) {
+    return (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+}
+
+// 수신한 파일에 소스의 권한 비트와 mtime 을 입힌다 (atime 은 그대로)
+void apply_file_meta(const fs::path &dest, uint32_t mode, int64_t mtime_ns) {
+    ::chmod(dest.c_str(), (mode_t)(mode & 07777));
+    struct timespec ts[2];
+    ts[0].tv_sec = 0;
+    ts[0].tv_nsec = UTIME_OMIT;
+    ts[1].tv_sec = (time_t)(mtime_ns / 1000000000LL);
+    ts[1].tv_nsec = (long)(mtime_ns % 1000000000LL);
+    ::utimensat(AT_FDCWD, dest.c_str(), ts, 0);
+}
+
 // ---------------- shell helpers ----------------
 int run_command(const std::string &cmd) {
     std::cout << "[CMD] " << cmd << std::endl;
@@ -115,278 +219,3713 @@ bool auto_extract_archive(const fs::path &archive_path) {
     return true; // 기타 확장자는 그냥 둠
 }
 
-// ---------------- HTTP download (수신 측) ----------------
-bool http_download_file(const std::string &host,
-                        int port,
-                        const std::string &path,
-                        const fs::path &dest,
-                        bool show_progress) {
-    httplib::Client cli(host.c_str(), port);
-    cli.set_read_timeout(300, 0);
+// ---------------- sha256 ----------------
+// 내용 비교용 SHA-256 (외부 라이브러리 없이)
+class Sha256 {
+public:
+    using Digest = std::array<uint8_t, 32>;
+
+    Sha256() { reset(); }
+
+    void reset() {
+        static const uint32_t init[8] = {
+            0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+            0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+        std::copy(init, init + 8, h_);
+        len_ = 0;
+        used_ = 0;
+    }
 
-    std::ofstream ofs(dest, std::ios::binary);
-    if (!ofs) {
-        std::cerr << "[DOWNLOAD] cannot open dest: " << dest << std::endl;
-        return false;
+    void update(const void *data, std::size_t n) {
+        auto *p = (const uint8_t *)data;
+        len_ += n;
+        if (used_) {
+            std::size_t take = std::min(n, (std::size_t)64 - used_);
+            std::memcpy(buf_ + used_, p, take);
+            used_ += take;
+            p += take;
+            n -= take;
+            if (used_ < 64) return;
+            block(buf_);
+            used_ = 0;
+        }
+        for (; n >= 64; p += 64, n -= 64) block(p);
+        std::memcpy(buf_, p, n);
+        used_ = n;
     }
 
-    uint64_t total = 0;
-    uint64_t downloaded = 0;
+    Digest finish() {
+        uint64_t bits = len_ * 8;
+        uint8_t pad = 0x80;
+        update(&pad, 1);
+        uint8_t zero = 0;
+        while (used_ != 56) update(&zero, 1);
+        uint8_t lenb[8];
+        for (int i = 0; i < 8; ++i) lenb[i] = (uint8_t)(bits >> (56 - 8 * i));
+        update(lenb, 8);
+        Digest d;
+        for (int i = 0; i < 8; ++i) {
+            d[4 * i] = (uint8_t)(h_[i] >> 24);
+            d[4 * i + 1] = (uint8_t)(h_[i] >> 16);
+            d[4 * i + 2] = (uint8_t)(h_[i] >> 8);
+            d[4 * i + 3] = (uint8_t)h_[i];
+        }
+        return d;
+    }
 
-    auto res = cli.Get(path.c_str(),
-        [&](const httplib::Response &res) {
-            if (res.has_header("Content-Length")) {
-                total = std::stoull(res.get_header_value("Content-Length"));
-            }
-            return true;
-        },
-        [&](const char *data, size_t data_length) {
-            ofs.write(data, data_length);
-            downloaded += data_length;
-            if (show_progress && total) draw_progress(downloaded, total);
-            return true;
+    static std::string hex(const Digest &d) {
+        static const char *digits = "0123456789abcdef";
+        std::string s;
+        for (uint8_t b : d) {
+            s.push_back(digits[b >> 4]);
+            s.push_back(digits[b & 15]);
         }
-    );
-    ofs.close();
+        return s;
+    }
 
-    if (!res || res->status != 200) {
-        std::cerr << "[DOWNLOAD] error: " << (res ? res->status : 0) << std::endl;
-        return false;
+private:
+    static uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+    void block(const uint8_t *p) {
+        static const uint32_t k[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+        uint32_t w[64];
+        for (int i = 0; i < 16; ++i) {
+            w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 |
+                   (uint32_t)p[4 * i + 2] << 8 | (uint32_t)p[4 * i + 3];
+        }
+        for (int i = 16; i < 64; ++i) {
+            uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        uint32_t a = h_[0], b = h_[1], c = h_[2], d = h_[3];
+        uint32_t e = h_[4], f = h_[5], g = h_[6], h = h_[7];
+        for (int i = 0; i < 64; ++i) {
+            uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+            uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+        h_[0] += a; h_[1] += b; h_[2] += c; h_[3] += d;
+        h_[4] += e; h_[5] += f; h_[6] += g; h_[7] += h;
     }
-    if (show_progress && total) std::cout << std::endl;
+
+    uint32_t h_[8];
+    uint8_t buf_[64];
+    std::size_t used_ = 0;
+    uint64_t len_ = 0;
+};
+
+bool sha256_file(const fs::path &path, Sha256::Digest &out) {
+    std::ifstream ifs(path, std::ios::binary);
+    if (!ifs) return false;
+    Sha256 h;
+    std::vector<char> buf(1 << 20);
+    while (ifs) {
+        ifs.read(buf.data(), (std::streamsize)buf.size());
+        h.update(buf.data(), (std::size_t)ifs.gcount());
+    }
+    if (ifs.bad()) return false;
+    out = h.finish();
     return true;
 }
 
-// ---------------- Pack mode ----------------
-enum class PackMode { NONE, TAR, GZ, TARGZ };
-
-struct ArchiveInfo {
-    fs::path archive_path;
-    std::string archive_name;
-    bool cleanup = false;
+// ---------------- binary manifest ----------------
+// 대량 경로 목록용 바이너리 manifest. JSON 대신 디렉토리 동기화/배치 전송에 쓴다.
+//   header = magic "P2PM" | version u8 | flags u8 | reserved u16 | count u64 (LE)
+//   entry  = varint 앞 entry 와 공유하는 경로 prefix 길이 | varint 나머지 길이 | 나머지 바이트
+//            | varint size | zigzag varint (mtime_ns - 앞 entry mtime_ns) | varint mode
+//            | [flags&IDS]  zigzag varint (id - 앞 entry id)
+//            | [flags&HASH] sha256 32 bytes (고정폭)
+// 순차 decode 만 하면 되므로 mmap 한 파일을 그대로 훑을 수 있다 (전체 역직렬화 없음).
+const uint32_t MANIFEST_MAGIC = 0x4d503250; // "P2PM"
+const uint8_t MANIFEST_VERSION = 1;
+const uint8_t MANIFEST_HAS_IDS = 0x01;
+const uint8_t MANIFEST_HAS_HASH = 0x02;
+const std::size_t MANIFEST_HEADER_SIZE = 16;
+
+struct ManifestEntry {
+    std::string path;
+    uint64_t size = 0;
+    int64_t mtime_ns = 0;
+    uint32_t mode = 0;
+    uint64_t id = 0;
+    Sha256::Digest hash{};
 };
 
-// ---------------- prepare_archive (송신 측) ----------------
-// 규칙:
-//  - 파일:
-//      NONE  -> 그대로 전송
-//      TAR   -> .tar (tar 사용)
-//      GZ    -> .gz (gzip 사용)
-//      TARGZ -> .tar.gz (tar -czf 사용)
-//  - 폴더:
-//      NONE  -> RAW 디렉토리 전송 (prepare_archive 사용 안 함; /api/send-file 에서 처리)
-//      TAR   -> .tar
-//      GZ    -> .tar.gz
-//      TARGZ -> .tar.gz
-ArchiveInfo prepare_archive(const fs::path &input, PackMode mode, bool /*auto_extract*/) {
-    ArchiveInfo info;
-    info.archive_path = input;
-    info.archive_name = input.filename().string();
-    info.cleanup = false;
+void put_varint(std::string &out, uint64_t v) {
+    while (v >= 0x80) {
+        out.push_back((char)(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((char)v);
+}
 
-    bool is_dir = fs::is_directory(input);
-    bool is_file = fs::is_regular_file(input);
-    if (!is_dir && !is_file) {
-        throw std::runtime_error("path is neither file nor directory");
+bool get_varint(const uint8_t *&p, const uint8_t *end, uint64_t &v) {
+    v = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7) {
+        uint8_t b = *p++;
+        v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) return true;
     }
+    return false;
+}
 
-    // 파일 + NONE -> 그대로
-    if (is_file && mode == PackMode::NONE) {
-        return info;
+uint64_t zigzag(int64_t v) { return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63); }
+int64_t unzigzag(uint64_t v) { return (int64_t)(v >> 1) ^ -(int64_t)(v & 1); }
+
+// out 이 열려 있으면 1MB 단위로 파일에 흘려 쓰고, 아니면 메모리 buffer 에 쌓는다.
+class ManifestWriter {
+public:
+    explicit ManifestWriter(uint8_t flags, std::ofstream *out = nullptr) : flags_(flags), out_(out) {
+        put_le(buf_, MANIFEST_MAGIC, 4);
+        buf_.push_back((char)MANIFEST_VERSION);
+        buf_.push_back((char)flags_);
+        put_le(buf_, 0, 2);
+        put_le(buf_, 0, 8); // count 는 finish() 에서 채움
     }
 
-    fs::path tmp = fs::temp_directory_path();
-    std::string base = input.filename().string();
+    void add(const ManifestEntry &e) {
+        std::size_t shared = 0;
+        std::size_t lim = std::min(prev_path_.size(), e.path.size());
+        while (shared < lim && prev_path_[shared] == e.path[shared]) ++shared;
+        put_varint(buf_, shared);
+        put_varint(buf_, e.path.size() - shared);
+        buf_.append(e.path, shared, std::string::npos);
+        put_varint(buf_, e.size);
+        put_varint(buf_, zigzag(e.mtime_ns - prev_mtime_));
+        put_varint(buf_, e.mode);
+        if (flags_ & MANIFEST_HAS_IDS) put_varint(buf_, zigzag((int64_t)(e.id - prev_id_)));
+        if (flags_ & MANIFEST_HAS_HASH) buf_.append((const char *)e.hash.data(), e.hash.size());
+        prev_path_ = e.path;
+        prev_mtime_ = e.mtime_ns;
+        prev_id_ = e.id;
+        count_++;
+        if (out_ && buf_.size() >= (1u << 20)) flush();
+    }
 
-    // 폴더 + NONE 은 RAW 모드에서 처리하므로 여기선 사용되지 않지만,
-    // 이전 호환성을 위해 남겨 둔다.
-    if (is_dir && mode == PackMode::NONE) {
-        // (이 코드 경로는 현재 로직에서는 호출되지 않음)
-        check_tools_for_pack(true, false); // tar 필요
-        info.archive_path = tmp / (base + ".tar");
-        info.archive_name = info.archive_path.filename().string();
-        std::string cmd = "cd \"" + input.parent_path().string() +
-                          "\" && tar -cf \"" + info.archive_path.string() +
-                          "\" \"" + base + "\"";
-        if (run_command(cmd) != 0) {
-            throw std::runtime_error("tar failed");
+    uint64_t count() const { return count_; }
+
+    // 메모리 모드면 완성된 manifest 를, 파일 모드면 빈 문자열을 돌려준다
+    std::string finish() {
+        std::string cnt;
+        put_le(cnt, count_, 8);
+        if (!out_) {
+            buf_.replace(8, 8, cnt);
+            return std::move(buf_);
         }
-        info.cleanup = true;
-        return info;
+        flush();
+        out_->seekp(8);
+        out_->write(cnt.data(), 8);
+        out_->flush();
+        return std::string();
     }
 
-    // 그 외: mode 에 따라 분기
-    if (is_dir) {
-        if (mode == PackMode::TAR) {
-            check_tools_for_pack(true, false);
-            info.archive_path = tmp / (base + ".tar");
-            info.archive_name = info.archive_path.filename().string();
-            std::string cmd = "cd \"" + input.parent_path().string() +
-                              "\" && tar -cf \"" + info.archive_path.string() +
-                              "\" \"" + base + "\"";
-            if (run_command(cmd) != 0) {
-                throw std::runtime_error("tar failed");
-            }
-        } else if (mode == PackMode::GZ || mode == PackMode::TARGZ) {
-            // 폴더의 경우 GZ, TARGZ 모두 tar.gz
-            check_tools_for_pack(true, false); // tar 만 있으면 tar -czf 가능
-            info.archive_path = tmp / (base + ".tar.gz");
-            info.archive_name = info.archive_path.filename().string();
-            std::string cmd = "cd \"" + input.parent_path().string() +
-                              "\" && tar -czf \"" + info.archive_path.string() +
-                              "\" \"" + base + "\"";
-            if (run_command(cmd) != 0) {
-                throw std::runtime_error("tar.gz failed");
-            }
+private:
+    void flush() {
+        out_->write(buf_.data(), (std::streamsize)buf_.size());
+        buf_.clear();
+    }
+
+    uint8_t flags_;
+    std::ofstream *out_;
+    std::string buf_;
+    std::string prev_path_;
+    int64_t prev_mtime_ = 0;
+    uint64_t prev_id_ = 0;
+    uint64_t count_ = 0;
+};
+
+// [data, data+len) 위를 앞에서부터 한 entry 씩 decode. 메모리 복사 없음.
+class ManifestReader {
+public:
+    ManifestReader(const void *data, std::size_t len)
+        : p_((const uint8_t *)data), end_((const uint8_t *)data + len) {
+        if (len < MANIFEST_HEADER_SIZE || get_le(p_, 4) != MANIFEST_MAGIC ||
+            p_[4] != MANIFEST_VERSION) {
+            p_ = end_;
+            return;
         }
-    } else { // is_file
-        if (mode == PackMode::TAR) {
-            check_tools_for_pack(true, false);
-            info.archive_path = tmp / (base + ".tar");
-            info.archive_name = info.archive_path.filename().string();
-            std::string cmd = "cd \"" + input.parent_path().string() +
-                              "\" && tar -cf \"" + info.archive_path.string() +
-                              "\" \"" + base + "\"";
-            if (run_command(cmd) != 0) {
-                throw std::runtime_error("tar failed");
-            }
-        } else if (mode == PackMode::GZ) {
-            check_tools_for_pack(false, true); // gzip 필요
-            info.archive_path = tmp / (base + ".gz");
-            info.archive_name = info.archive_path.filename().string();
-            std::string cmd = "gzip -c \"" + input.string() +
-                              "\" > \"" + info.archive_path.string() + "\"";
-            if (run_command(cmd) != 0) {
-                throw std::runtime_error("gzip failed");
-            }
-        } else if (mode == PackMode::TARGZ) {
-            check_tools_for_pack(true, false);
-            info.archive_path = tmp / (base + ".tar.gz");
-            info.archive_name = info.archive_path.filename().string();
-            std::string cmd = "cd \"" + input.parent_path().string() +
-                              "\" && tar -czf \"" + info.archive_path.string() +
-                              "\" \"" + base + "\"";
-            if (run_command(cmd) != 0) {
-                throw std::runtime_error("tar.gz failed");
-            }
+        flags_ = p_[5];
+        count_ = get_le(p_ + 8, 8);
+        p_ += MANIFEST_HEADER_SIZE;
+        // entry 는 최소 varint 5개(+ id, hash) 이므로 본문 길이로 count 를 확인한다 (헤더만 믿지 않음)
+        std::size_t min_entry = 5 + ((flags_ & MANIFEST_HAS_IDS) ? 1 : 0) + ((flags_ & MANIFEST_HAS_HASH) ? 32 : 0);
+        if (count_ > (uint64_t)(end_ - p_) / min_entry) {
+            p_ = end_;
+            return;
         }
+        valid_ = true;
     }
 
-    info.cleanup = true;
-    return info;
-}
+    bool valid() const { return valid_; }
+    uint64_t count() const { return count_; }
+    uint8_t flags() const { return flags_; }
+
+    // 다음 entry. 끝이거나 깨진 데이터면 false.
+    bool next(ManifestEntry &e) {
+        if (!valid_ || read_ >= count_) return false;
+        uint64_t shared, rest, size, dm, mode, did = 0;
+        if (!get_varint(p_, end_, shared) || !get_varint(p_, end_, rest) ||
+            shared > path_.size() || rest > (uint64_t)(end_ - p_)) return fail();
+        path_.resize((std::size_t)shared);
+        path_.append((const char *)p_, (std::size_t)rest);
+        p_ += rest;
+        if (!get_varint(p_, end_, size) || !get_varint(p_, end_, dm) ||
+            !get_varint(p_, end_, mode)) return fail();
+        if ((flags_ & MANIFEST_HAS_IDS) && !get_varint(p_, end_, did)) return fail();
+        mtime_ += unzigzag(dm);
+        id_ += (uint64_t)unzigzag(did);
+        e.path = path_;
+        e.size = size;
+        e.mtime_ns = mtime_;
+        e.mode = (uint32_t)mode;
+        e.id = id_;
+        if (flags_ & MANIFEST_HAS_HASH) {
+            if (end_ - p_ < 32) return fail();
+            std::memcpy(e.hash.data(), p_, 32);
+            p_ += 32;
+        }
+        read_++;
+        return true;
+    }
 
-// ---------------- node info (master) ----------------
-struct NodeInfo {
-    std::string host;
-    int ctrl_port;
-    std::string name;
-    uint64_t last_seen;
+private:
+    bool fail() {
+        valid_ = false;
+        return false;
+    }
+
+    const uint8_t *p_;
+    const uint8_t *end_;
+    bool valid_ = false;
+    uint8_t flags_ = 0;
+    uint64_t count_ = 0;
+    uint64_t read_ = 0;
+    std::string path_;
+    int64_t mtime_ = 0;
+    uint64_t id_ = 0;
 };
 
-std::mutex g_nodes_mutex;
-std::vector<NodeInfo> g_nodes;
+// 읽기 전용 mmap
+class MappedFile {
+public:
+    explicit MappedFile(const fs::path &path) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return;
+        struct stat st;
+        if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+            void *m = ::mmap(nullptr, (std::size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (m != MAP_FAILED) {
+                data_ = m;
+                size_ = (std::size_t)st.st_size;
+                ::madvise(m, size_, MADV_SEQUENTIAL);
+            }
+        }
+        ::close(fd);
+    }
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    ~MappedFile() { if (data_) ::munmap(data_, size_); }
 
-// ---------------- configs ----------------
-struct ControlConfig {
-    std::string bind_host;
-    int bind_port;
-    bool is_master = false;
-    std::string master_host;
-    int master_port = 7000;
-    std::string public_host;
-    std::string node_name;
-};
+    const void *data() const { return data_; }
+    std::size_t size() const { return size_; }
 
-struct SendConfig {
-    std::string source_host;
-    int source_ctrl_port;
-    std::string source_file;
-    std::string target_host;
-    int target_ctrl_port;
-    std::string target_save;
-    int send_port;
-    PackMode pack_mode;
-    bool auto_extract;
-    bool progress;
-    bool is_dir;
+private:
+    void *data_ = nullptr;
+    std::size_t size_ = 0;
 };
 
-struct SendAllConfig {
-    std::string master_host;
-    int master_port;
-    std::string source_host;
-    int source_ctrl_port;
-    std::string source_file;
-    int send_port;
-    std::string target_save;
-    PackMode pack_mode;
-    bool auto_extract;
-    bool progress;
-    bool is_dir;
-};
+// dir 아래 일반 파일의 manifest 를 out 파일로 쓴다 (경로는 dir 기준 상대). 항목 수 반환.
+uint64_t write_dir_manifest(const fs::path &dir, bool with_hash, std::ofstream &out) {
+    ManifestWriter w(with_hash ? MANIFEST_HAS_HASH : 0, &out);
+    std::error_code ec;
+    fs::recursive_directory_iterator it(dir, fs::directory_options::skip_permission_denied, ec), end;
+    for (; !ec && it != end; it.increment(ec)) {
+        std::error_code ec2;
+        if (!it->is_regular_file(ec2)) continue;
+        struct stat st;
+        if (::stat(it->path().c_str(), &st) != 0) continue;
+        ManifestEntry e;
+        e.path = it->path().lexically_relative(dir).generic_string();
+        e.size = (uint64_t)st.st_size;
+        e.mtime_ns = stat_mtime_ns(st);
+        e.mode = (uint32_t)(st.st_mode & 07777);
+        if (with_hash && !sha256_file(it->path(), e.hash)) continue;
+        w.add(e);
+    }
+    w.finish();
+    return w.count();
+}
 
-// forward
-void start_control_server(const ControlConfig &cfg);
-void start_send(const SendConfig &cfg);
-void start_send_all(const SendAllConfig &cfg);
+// ---------------- rate limiter ----------------
+// lock-free 토큰 버킷 (GCRA). 다음 바이트가 허용되는 시각(tat)만 CAS 로 밀어 올리고
+// burst 를 넘어선 만큼 호출 스레드가 잔다. rate == 0 이면 consume() 은 load 한 번으로 끝난다.
+class RateLimiter {
+public:
+    explicit RateLimiter(uint64_t bytes_per_sec = 0) : rate_(bytes_per_sec) {}
+
+    void set_rate(uint64_t bytes_per_sec) { rate_.store(bytes_per_sec, std::memory_order_relaxed); }
+    uint64_t rate() const { return rate_.load(std::memory_order_relaxed); }
+
+    void consume(size_t n) {
+        uint64_t rate = rate_.load(std::memory_order_relaxed);
+        if (!rate || !n) return;
+        const int64_t burst_ns = 50'000'000; // 50ms 만큼은 몰아서 보낼 수 있음
+        int64_t cost = (int64_t)((double)n * 1e9 / (double)rate);
+        int64_t now = now_ns();
+        int64_t tat = tat_.load(std::memory_order_relaxed);
+        int64_t next;
+        do {
+            next = std::max(tat, now) + cost;
+        } while (!tat_.compare_exchange_weak(tat, next, std::memory_order_relaxed));
+        int64_t wait = next - now - burst_ns;
+        if (wait > 0) std::this_thread::sleep_for(std::chrono::nanoseconds(wait));
+    }
 
-// ---------------- CONTROL SERVER ----------------
-void start_control_server(const ControlConfig &cfg) {
-    httplib::Server svr;
+private:
+    static int64_t now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
 
-    std::cout << "\n[CONTROL] 서버 시작"
-              << "\n  bind: " << cfg.bind_host << ":" << cfg.bind_port
-              << "\n  mode: " << (cfg.is_master ? "MASTER" :
-                                  (cfg.master_host.empty() ? "STANDALONE" : "WORKER"))
-              << std::endl;
+    std::atomic<uint64_t> rate_;
+    std::atomic<int64_t> tat_{0};
+};
 
-    svr.Get("/api/health", [](const httplib::Request&, httplib::Response &res) {
-        json j; j["status"] = "ok";
-        res.set_content(j.dump(), "application/json");
-    });
+// 한 전송에 걸리는 버킷 묶음 (전송별 / 대상별 / 노드 전체). 비어 있는 칸은 무시.
+// target 은 같은 대상 호스트로 가는 전송끼리 나누는 버킷이고, 요청에 targetRateLimit 이 오면
+// 그 값은 이 요청만의 target_override 버킷이 된다 (공유 버킷의 rate 는 건드리지 않는다).
+struct RateLimits {
+    std::shared_ptr<RateLimiter> transfer;
+    std::shared_ptr<RateLimiter> target;
+    std::shared_ptr<RateLimiter> target_override;
+    RateLimiter *node = nullptr;
+
+    bool any() const { return transfer || target || target_override || (node && node->rate()); }
+
+    void consume(size_t n) const {
+        if (transfer) transfer->consume(n);
+        if (target) target->consume(n);
+        if (target_override) target_override->consume(n);
+        if (node) node->consume(n);
+    }
+};
 
-    // MASTER
-    if (cfg.is_master) {
-        {
-            NodeInfo self;
-            self.host = cfg.public_host.empty() ? cfg.bind_host : cfg.public_host;
-            self.ctrl_port = cfg.bind_port;
-            self.name = cfg.node_name.empty() ? "master" : cfg.node_name;
-            self.last_seen = (uint64_t)std::time(nullptr);
-            std::lock_guard<std::mutex> lk(g_nodes_mutex);
-            g_nodes.push_back(self);
-            std::cout << "[MASTER] 자기 자신 등록: " << self.host << ":" << self.ctrl_port << "\n";
+RateLimiter g_node_send_limiter; // 노드 전체 송신 상한 (--node-rate-limit)
+RateLimiter g_node_recv_limiter; // 노드 전체 수신 상한 (--node-rate-limit)
+
+std::mutex g_target_limiters_mutex;
+std::map<std::string, std::shared_ptr<RateLimiter>> g_target_limiters;
+uint64_t g_target_rate_default = 0; // --target-rate-limit
+
+// 대상 호스트별 송신 버킷 (--target-rate-limit). 꺼져 있으면 nullptr.
+// 목록이 TARGET_LIMITERS_MAX 를 넘으면 쓰는 전송이 없는 버킷부터 버린다.
+const std::size_t TARGET_LIMITERS_MAX = 1024;
+
+std::shared_ptr<RateLimiter> target_limiter(const std::string &host) {
+    if (!g_target_rate_default) return nullptr;
+    std::lock_guard<std::mutex> lk(g_target_limiters_mutex);
+    auto it = g_target_limiters.find(host);
+    if (it != g_target_limiters.end()) return it->second;
+    if (g_target_limiters.size() >= TARGET_LIMITERS_MAX) {
+        for (auto i = g_target_limiters.begin(); i != g_target_limiters.end();) {
+            if (i->second.use_count() == 1) i = g_target_limiters.erase(i);
+            else ++i;
         }
+    }
+    return g_target_limiters.emplace(host, std::make_shared<RateLimiter>(g_target_rate_default)).first->second;
+}
 
-        svr.Post("/api/register-node", [](const httplib::Request &req, httplib::Response &res) {
-            try {
-                auto j = json::parse(req.body);
-                std::string host = j.value("host", "");
-                int ctrl_port = j.value("ctrlPort", 0);
-                std::string name = j.value("name", "");
-                if (host.empty() || ctrl_port == 0) {
+// JSON 필드의 크기/속도 값: 숫자(바이트) 또는 "50M" 같은 문자열
+uint64_t json_size(const json &j, const char *key) {
+    auto it = j.find(key);
+    if (it == j.end() || it->is_null()) return 0;
+    if (it->is_number_unsigned() || it->is_number_integer()) {
+        auto v = it->get<int64_t>();
+        return v > 0 ? (uint64_t)v : 0;
+    }
+    if (it->is_string()) return parse_size(it->get<std::string>());
+    return 0;
+}
+
+// ---------------- sparse file ----------------
+// 구멍(hole) 이 많은 파일(VM 이미지, DB 파일)은 데이터 구간만 보낸다.
+// 수신 측이 X-Accept-Sparse: 1 을 보내고 원본에 구멍이 있으면 본문을 아래 프레임으로 바꾼다.
+//   header = magic "P2PS" u32 | 논리 크기 u64 (LE)
+//   extent = offset u64 | length u64 | data(length)
+//   끝     = offset(논리 크기) u64 | length 0 u64
+// 수신 측은 extent 를 해당 offset 에 쓰고 마지막에 논리 크기로 맞춘다 (나머지는 구멍으로 남음).
+const uint32_t SPARSE_MAGIC = 0x53503250; // "P2PS"
+const std::size_t SPARSE_HEADER_SIZE = 12;
+const std::size_t SPARSE_EXTENT_HEADER_SIZE = 16;
+const char *SPARSE_CONTENT_TYPE = "application/x-p2p-sparse";
+
+struct Extent {
+    uint64_t offset;
+    uint64_t length;
+};
+
+// path 의 데이터 구간 (SEEK_DATA/SEEK_HOLE). 구멍이 없거나 파일시스템이 지원하지 않으면 false.
+bool sparse_extents(const fs::path &path, uint64_t size, std::vector<Extent> &out) {
+    out.clear();
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st;
+    // 할당 블록이 논리 크기보다 작을 때만 구간을 훑는다
+    bool holes = ::fstat(fd, &st) == 0 && (uint64_t)st.st_blocks * 512 < size;
+    uint64_t data_bytes = 0;
+    for (off_t pos = 0; holes && (uint64_t)pos < size; ) {
+        off_t data = ::lseek(fd, pos, SEEK_DATA);
+        if (data < 0) {
+            if (errno != ENXIO) holes = false; // ENXIO = 뒤에는 구멍뿐
+            break;
+        }
+        off_t hole = ::lseek(fd, data, SEEK_HOLE);
+        if (hole < 0) {
+            holes = false;
+            break;
+        }
+        out.push_back({(uint64_t)data, (uint64_t)(hole - data)});
+        data_bytes += (uint64_t)(hole - data);
+        pos = hole;
+    }
+    ::close(fd);
+    if (!holes || data_bytes >= size) {
+        out.clear();
+        return false;
+    }
+    return true;
+}
+
+// 프레임 스트림 총 길이 (Content-Length)
+uint64_t sparse_stream_size(const std::vector<Extent> &extents) {
+    uint64_t n = SPARSE_HEADER_SIZE + SPARSE_EXTENT_HEADER_SIZE;
+    for (auto &e : extents) n += SPARSE_EXTENT_HEADER_SIZE + e.length;
+    return n;
+}
+
+// 받은 프레임 스트림을 dest 에 푼다. 조각이 어디서 잘려 와도 된다.
+class SparseWriter {
+public:
+    explicit SparseWriter(std::ofstream &ofs) : ofs_(ofs) {}
+
+    bool feed(const char *data, std::size_t len) {
+        while (len > 0) {
+            if (remaining_ > 0) {
+                std::size_t n = (std::size_t)std::min<uint64_t>(remaining_, len);
+                ofs_.write(data, (std::streamsize)n);
+                data += n;
+                len -= n;
+                remaining_ -= n;
+                continue;
+            }
+            if (finished_) return false; // 끝 표시 뒤에 더 오면 깨진 스트림
+            std::size_t need = (have_size_ ? SPARSE_EXTENT_HEADER_SIZE : SPARSE_HEADER_SIZE) - head_.size();
+            std::size_t take = std::min(need, len);
+            head_.append(data, take);
+            data += take;
+            len -= take;
+            if (take == need && !parse_head()) return false;
+        }
+        return (bool)ofs_;
+    }
+
+    bool finished() const { return finished_; }
+    uint64_t logical_size() const { return size_; }
+
+private:
+    bool parse_head() {
+        auto *h = (const unsigned char *)head_.data();
+        if (!have_size_) {
+            if (get_le(h, 4) != SPARSE_MAGIC) return false;
+            size_ = get_le(h + 4, 8);
+            have_size_ = true;
+        } else {
+            uint64_t off = get_le(h, 8);
+            remaining_ = get_le(h + 8, 8);
+            if (off > size_ || remaining_ > size_ - off) return false;
+            if (remaining_ == 0) finished_ = true;
+            else ofs_.seekp((std::streamoff)off);
+        }
+        head_.clear();
+        return true;
+    }
+
+    std::ofstream &ofs_;
+    std::string head_;
+    bool have_size_ = false;
+    bool finished_ = false;
+    uint64_t size_ = 0;
+    uint64_t remaining_ = 0;
+};
+
+// ---------------- local copy ----------------
+// 소스와 대상이 같은 머신이면 HTTP 를 거치지 않고 대상 노드가 커널 안에서 바로 복사한다.
+// 같은 머신 판단: /api/health 의 nodeId (boot_id + hostname) 비교. 네트워크와 hostname 은 같고 mount
+// namespace 만 다른 컨테이너는 이걸로 구분이 안 되므로, 소스는 파일마다 st_dev/st_ino/크기/mtime 을
+// 함께 보내고 대상은 자기가 본 원본과 하나라도 다르면 409 로 돌려보내 네트워크 전송으로 되돌아간다.
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+
+const std::size_t LOCAL_COPY_CHUNK = 2 * 1024 * 1024;
+
+std::string read_first_line(const fs::path &path) {
+    std::ifstream ifs(path);
+    std::string line;
+    std::getline(ifs, line);
+    return line;
+}
+
+const std::string &node_identity() {
+    static const std::string id = [] {
+        char host[256] = {0};
+        ::gethostname(host, sizeof(host) - 1);
+        return read_first_line("/proc/sys/kernel/random/boot_id") + ":" + host;
+    }();
+    return id;
+}
+
+// 로컬 복사 요청에 싣는 원본의 정체
+json local_file_id(uint64_t dev, uint64_t ino, uint64_t size, int64_t mtime_ns) {
+    return {{"dev", dev}, {"ino", ino}, {"size", size}, {"mtimeNs", mtime_ns}};
+}
+
+// 대상에서 src 가 소스가 보낸 f 의 dev/ino/size/mtimeNs 와 같은 파일인지. 필드가 없으면 false.
+bool local_file_matches(const fs::path &src, const json &f) {
+    for (const char *k : {"dev", "ino", "size", "mtimeNs"}) {
+        if (!f.contains(k) || !f[k].is_number_integer()) return false;
+    }
+    struct stat st;
+    if (src.empty() || ::stat(src.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) return false;
+    return f["dev"].get<uint64_t>() == (uint64_t)st.st_dev && f["ino"].get<uint64_t>() == (uint64_t)st.st_ino &&
+           f["size"].get<uint64_t>() == (uint64_t)st.st_size && f["mtimeNs"].get<int64_t>() == stat_mtime_ns(st);
+}
+
+// host:port 의 노드가 이 머신에서 도는지와 그 노드의 컨트롤 unix socket 경로.
+// 결과는 주소별로 기억한다.
+struct LocalPeer {
+    bool same = false;
+    std::string ctrl_socket;
+};
+
+LocalPeer local_peer(const std::string &host, int port) {
+    static std::mutex mu;
+    static std::map<std::string, LocalPeer> cache;
+    std::string key = host + ":" + std::to_string(port);
+    {
+        std::lock_guard<std::mutex> lk(mu);
+        auto it = cache.find(key);
+        if (it != cache.end()) return it->second;
+    }
+    httplib::Client cli(host.c_str(), port);
+    cli.set_connection_timeout(2, 0);
+    cli.set_read_timeout(5, 0);
+    auto res = cli.Get("/api/health");
+    LocalPeer peer;
+    if (!res) return peer; // 연결 실패는 기억하지 않음
+    if (res->status == 200) {
+        try {
+            auto j = json::parse(res->body);
+            peer.same = j.value("nodeId", "") == node_identity();
+            if (peer.same) peer.ctrl_socket = j.value("ctrlSocket", "");
+        } catch (...) {}
+    }
+    std::lock_guard<std::mutex> lk(mu);
+    cache[key] = peer;
+    return peer;
+}
+
+// src → dest 커널 내 복사. reflink(FICLONE) → copy_file_range → read/write 순으로 시도한다.
+// 구멍 있는 파일은 데이터 구간만 복사해 구멍을 유지한다. method 에 쓴 방법을 남긴다.
+bool local_copy_file(const fs::path &src, const fs::path &dest, const RateLimits &limits,
+                     uint64_t *bytes_out, std::string *method) {
+    int in = ::open(src.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) return false;
+    struct stat st;
+    if (::fstat(in, &st) != 0) {
+        ::close(in);
+        return false;
+    }
+    int out = ::open(dest.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out < 0) {
+        ::close(in);
+        return false;
+    }
+    uint64_t size = (uint64_t)st.st_size;
+    uint64_t copied = 0;
+    bool ok = true;
+    std::string how = "reflink";
+
+    if (limits.any() || ::ioctl(out, FICLONE, in) != 0) {
+        // 대역폭 제한이 걸려 있으면 reflink 는 건너뛰고 조각 단위로 복사
+        std::vector<Extent> extents;
+        if (!sparse_extents(src, size, extents) && size > 0) extents.push_back({0, size});
+        how = "copy_file_range";
+        std::vector<char> buf;
+        for (auto &e : extents) {
+            off_t off_in = (off_t)e.offset;
+            off_t off_out = (off_t)e.offset;
+            uint64_t left = e.length;
+            while (ok && left > 0) {
+                std::size_t want = (std::size_t)std::min<uint64_t>(left, LOCAL_COPY_CHUNK);
+                limits.consume(want);
+                ssize_t n = -1;
+                if (how == "copy_file_range") {
+                    n = ::copy_file_range(in, &off_in, out, &off_out, want, 0);
+                    if (n < 0 && (errno == EXDEV || errno == ENOSYS || errno == EINVAL ||
+                                  errno == EOPNOTSUPP)) {
+                        how = "copy";
+                    }
+                }
+                if (how == "copy") {
+                    buf.resize(want);
+                    n = ::pread(in, buf.data(), want, off_in);
+                    if (n > 0) n = ::pwrite(out, buf.data(), (std::size_t)n, off_out);
+                    if (n > 0) {
+                        off_in += n;
+                        off_out += n;
+                    }
+                }
+                if (n <= 0) {
+                    ok = false;
+                    break;
+                }
+                left -= (uint64_t)n;
+                copied += (uint64_t)n;
+            }
+        }
+        if (ok && ::ftruncate(out, (off_t)size) != 0) ok = false;
+    } else {
+        copied = size;
+    }
+    ::close(in);
+    if (::close(out) != 0) ok = false;
+    if (!ok) return false;
+    apply_file_meta(dest, (uint32_t)(st.st_mode & 07777), stat_mtime_ns(st));
+    if (bytes_out) *bytes_out = copied;
+    if (method) *method = how;
+    return true;
+}
+
+// ---------------- content store ----------------
+// 받은 파일을 SHA-256 으로 찾을 수 있게 모아 두는 노드별 저장소 (--cas-dir).
+// <dir>/<hex 앞 2자>/<hex> 는 받은 파일의 reflink 사본, 안 되면 복사본이고 (--cas-hardlink 면
+// 복사 대신 같은 inode 의 hardlink) 옆의 <hex>.meta 에 넣을 때의 크기와 mtime 을 적어 둔다.
+// hardlink 인 경우 받은 파일을 제자리에서 고치면 저장소 쪽도 바뀌므로, 조회할 때 meta 와 다르면 버린다.
+// 같은 내용을 다시 받을 때 (/api/download-file 에 sha256 이 오면) 네트워크 대신 여기서 clone/복사한다.
+// 꺼낸 파일은 저장소와 inode 를 나누지 않는다 (나누면 서로 다른 받은 파일끼리 내용이 같이 바뀐다).
+fs::path g_cas_dir;
+bool g_cas_hardlink = false;
+
+const uint64_t CAS_MIN_BYTES = 64 * 1024; // 작은 파일은 넣지 않는다
+
+bool is_sha256_hex(const std::string &s) {
+    if (s.size() != 64) return false;
+    for (char c : s) {
+        if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'))) return false;
+    }
+    return true;
+}
+
+fs::path cas_object_path(const std::string &hex) {
+    return g_cas_dir / hex.substr(0, 2) / hex;
+}
+
+// 저장소에 hex 가 있고 meta 와 맞으면 true. size 가 0 이 아니면 크기도 확인한다.
+// 어긋난 항목은 지운다.
+bool cas_lookup(const std::string &hex, uint64_t size, fs::path *obj_out = nullptr) {
+    if (g_cas_dir.empty() || !is_sha256_hex(hex)) return false;
+    fs::path obj = cas_object_path(hex);
+    struct stat st;
+    if (::stat(obj.c_str(), &st) != 0) return false;
+    std::istringstream meta(read_first_line(obj.string() + ".meta"));
+    uint64_t m_size = 0;
+    int64_t m_mtime = 0;
+    if (!(meta >> m_size >> m_mtime) || m_size != (uint64_t)st.st_size ||
+        m_mtime != stat_mtime_ns(st)) {
+        std::cout << "[CAS] 바뀐 항목 제거: " << hex << "\n";
+        std::error_code ec;
+        fs::remove(obj, ec);
+        fs::remove(obj.string() + ".meta", ec);
+        return false;
+    }
+    if (size && size != m_size) return false;
+    if (obj_out) *obj_out = obj;
+    return true;
+}
+
+// file 을 hex 로 저장소에 넣는다. reflink → (--cas-hardlink 면 hardlink) → 복사 순으로 시도한다.
+bool cas_put(const fs::path &file, const std::string &hex) {
+    if (g_cas_dir.empty() || !is_sha256_hex(hex)) return false;
+    struct stat st;
+    if (::stat(file.c_str(), &st) != 0 || (uint64_t)st.st_size < CAS_MIN_BYTES) return false;
+    if (cas_lookup(hex, (uint64_t)st.st_size)) return true;
+
+    fs::path obj = cas_object_path(hex);
+    ensure_dir(obj.parent_path());
+    fs::path tmp = obj.string() + ".tmp-" +
+                   std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+    ::unlink(tmp.c_str());
+    bool ok = false;
+    int in = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    int out = in < 0 ? -1 : ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0444);
+    if (out >= 0) {
+        ok = ::ioctl(out, FICLONE, in) == 0;
+        ::close(out);
+        if (!ok) ::unlink(tmp.c_str());
+    }
+    if (in >= 0) ::close(in);
+    if (!ok && g_cas_hardlink) ok = ::link(file.c_str(), tmp.c_str()) == 0;
+    if (!ok) ok = local_copy_file(file, tmp, RateLimits(), nullptr, nullptr);
+    if (!ok || ::rename(tmp.c_str(), obj.c_str()) != 0) {
+        ::unlink(tmp.c_str());
+        return false;
+    }
+    if (::stat(obj.c_str(), &st) != 0) return false;
+    std::ofstream meta(obj.string() + ".meta", std::ios::trunc);
+    meta << (uint64_t)st.st_size << " " << stat_mtime_ns(st) << "\n";
+    return (bool)meta;
+}
+
+// 방금 받은 dest 를 해시해 저장소에 넣는다. expected 가 있으면 내용을 확인해
+// 다르면 false (받은 파일이 깨졌다는 뜻이므로 넣지 않는다).
+bool cas_admit(const fs::path &dest, const std::string &expected) {
+    if (g_cas_dir.empty()) return true;
+    Sha256::Digest d;
+    if (!sha256_file(dest, d)) return true;
+    std::string hex = Sha256::hex(d);
+    if (!expected.empty() && hex != expected) {
+        std::cerr << "[CAS] 해시 불일치: " << dest << "\n";
+        return false;
+    }
+    if (cas_put(dest, hex)) std::cout << "[CAS] 저장: " << hex << "\n";
+    return true;
+}
+
+// 저장소의 hex 를 dest 로 꺼낸다: reflink → 로컬 복사 (local_copy_file). method 에 쓴 방법을 남긴다.
+bool cas_fetch(const std::string &hex, uint64_t size, const fs::path &dest, std::string *method) {
+    fs::path obj;
+    if (!cas_lookup(hex, size, &obj)) return false;
+    ::unlink(dest.c_str()); // 기존 파일이 저장소와 같은 inode 일 수 있으므로 덮어쓰지 않고 새로 만든다
+    return local_copy_file(obj, dest, RateLimits(), nullptr, method);
+}
+
+// 보내는 쪽: 같은 파일을 여러 대상에 보낼 때 한 번만 해시하도록 (dev, inode, 크기, mtime) 으로 기억한다.
+bool cached_file_sha256(const fs::path &path, std::string &hex) {
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0) return false;
+    std::string key = std::to_string(st.st_dev) + ":" + std::to_string(st.st_ino) + ":" +
+                      std::to_string(st.st_size) + ":" + std::to_string(stat_mtime_ns(st));
+    static std::mutex mu;
+    static std::map<std::string, std::string> memo;
+    {
+        std::lock_guard<std::mutex> lk(mu);
+        auto it = memo.find(key);
+        if (it != memo.end()) {
+            hex = it->second;
+            return true;
+        }
+    }
+    Sha256::Digest d;
+    if (!sha256_file(path, d)) return false;
+    hex = Sha256::hex(d);
+    std::lock_guard<std::mutex> lk(mu);
+    memo[key] = hex;
+    return true;
+}
+
+// ---------------- unix domain socket ----------------
+// --uds-dir 를 주면 컨트롤 서버가 <dir>/ctrl-<port>.sock 에서도 듣고, 같은 머신 대상으로 가는
+// 데이터 서버는 TCP 포트 대신 <dir>/data-<pid>-<n>.sock 에서 듣는다 (loopback TCP 스택을 건너뜀).
+// 데이터 URL 은 "http+unix://<%2F 로 인코딩한 socket 경로>/<path>" 형식이고,
+// 클라이언트 쪽에서는 host 가 '/' 로 시작하면 socket 경로로 본다.
+fs::path g_uds_dir;
+std::string g_ctrl_socket; // 이 노드의 컨트롤 socket (health 로 알림)
+
+// 남아 있는 socket 파일을 지우고 svr 를 path 에 bind
+bool listen_unix(httplib::Server &svr, const fs::path &path) {
+    std::error_code ec;
+    fs::remove(path, ec);
+    svr.set_address_family(AF_UNIX);
+    return svr.bind_to_port(path.string(), 80);
+}
+
+httplib::Client make_client(const std::string &host, int port) {
+    if (!host.empty() && host[0] == '/') {
+        httplib::Client cli(host, 80);
+        cli.set_address_family(AF_UNIX);
+        return cli;
+    }
+    return httplib::Client(host, port);
+}
+
+// 컨트롤 API 클라이언트. 같은 머신의 노드가 unix socket 을 열어 두었으면 그쪽으로 붙는다.
+httplib::Client ctrl_client(const std::string &host, int port) {
+    if (!g_uds_dir.empty()) {
+        LocalPeer peer = local_peer(host, port);
+        if (peer.same && !peer.ctrl_socket.empty() && ::access(peer.ctrl_socket.c_str(), W_OK) == 0) {
+            return make_client(peer.ctrl_socket, 0);
+        }
+    }
+    return httplib::Client(host, port);
+}
+
+std::string unix_url(const fs::path &sock, const std::string &path) {
+    return "http+unix://" + httplib::encode_uri_component(sock.string()) + path;
+}
+
+// ---------------- shared memory ring ----------------
+// 같은 머신 대상용 memfd 링 버퍼 전송 (transport: "shm").
+// 소스가 memfd 에 링을 만들고 파일을 채워 넣는 동안, 대상은 /proc/<소스 pid>/fd/<fd> 로
+// 같은 memfd 를 열어 mmap 한 뒤 읽어 간다. 소켓도 커널 복사도 거치지 않는다.
+//   [0, 4096)    ShmRingHeader (head/tail 은 누적 바이트, *_seq 는 futex 대기용)
+//   [4096, ...)  데이터 capacity 바이트
+const uint32_t SHM_RING_MAGIC = 0x52503250; // "P2PR"
+const std::size_t SHM_RING_DATA_OFFSET = 4096;
+const std::size_t SHM_RING_BYTES = 16 * 1024 * 1024;
+
+struct ShmRingHeader {
+    uint32_t magic;
+    uint32_t writer_pid;            // 소스 프로세스 (죽었는지 확인용)
+    uint64_t capacity;
+    std::atomic<uint64_t> head;     // 소스가 쓴 누적 바이트
+    std::atomic<uint64_t> tail;     // 대상이 읽은 누적 바이트
+    std::atomic<uint32_t> head_seq; // head 가 바뀔 때마다 +1
+    std::atomic<uint32_t> tail_seq; // tail 이 바뀔 때마다 +1
+    std::atomic<uint32_t> state;    // SHM_* 비트
+    std::atomic<uint32_t> reader_pid; // 대상 프로세스 (attach 때 채움)
+};
+
+const uint32_t SHM_WRITER_DONE = 1;
+const uint32_t SHM_WRITER_FAILED = 2;
+const uint32_t SHM_READER_CLOSED = 4;
+
+// 프로세스 간 futex (공유 매핑이므로 PRIVATE 아님). 100ms 마다 깨어 상대 상태를 다시 보고,
+// 상대 프로세스가 사라졌으면 (죽으면 DONE/FAILED/CLOSED 를 못 남긴다) 기다림을 끝낸다.
+// (죽었지만 부모가 아직 거두지 않은 zombie 도 죽은 것으로 본다)
+bool shm_peer_alive(uint32_t pid) {
+    if (pid == 0) return true;
+    if (::kill((pid_t)pid, 0) != 0 && errno == ESRCH) return false;
+    std::string st = read_first_line("/proc/" + std::to_string(pid) + "/stat");
+    std::size_t p = st.rfind(')');
+    return p == std::string::npos || p + 2 >= st.size() || (st[p + 2] != 'Z' && st[p + 2] != 'X');
+}
+
+void shm_futex_wait(std::atomic<uint32_t> &word, uint32_t expected) {
+    struct timespec ts{0, 100 * 1000 * 1000};
+    ::syscall(SYS_futex, (uint32_t *)&word, FUTEX_WAIT, expected, &ts, nullptr, 0);
+}
+
+void shm_futex_wake(std::atomic<uint32_t> &word) {
+    word.fetch_add(1, std::memory_order_release);
+    ::syscall(SYS_futex, (uint32_t *)&word, FUTEX_WAKE, INT32_MAX, nullptr, nullptr, 0);
+}
+
+class ShmRing {
+public:
+    ShmRing(const ShmRing &) = delete;
+    ShmRing &operator=(const ShmRing &) = delete;
+    ~ShmRing() {
+        if (base_) ::munmap(base_, map_size_);
+        if (fd_ >= 0) ::close(fd_);
+    }
+
+    // 소스: 새 링
+    static std::unique_ptr<ShmRing> create(std::size_t capacity) {
+        int fd = ::memfd_create("p2p-ring", MFD_CLOEXEC);
+        if (fd < 0) return nullptr;
+        std::unique_ptr<ShmRing> ring(new ShmRing(fd));
+        if (::ftruncate(fd, (off_t)(SHM_RING_DATA_OFFSET + capacity)) != 0 || !ring->map()) return nullptr;
+        ShmRingHeader *h = ring->hdr();
+        h->capacity = capacity;
+        h->head.store(0);
+        h->tail.store(0);
+        h->head_seq.store(0);
+        h->tail_seq.store(0);
+        h->state.store(0);
+        h->reader_pid.store(0);
+        h->writer_pid = (uint32_t)::getpid();
+        h->magic = SHM_RING_MAGIC;
+        return ring;
+    }
+
+    // 대상: 소스가 알려 준 /proc/<pid>/fd/<fd> 경로로 붙는다
+    static std::unique_ptr<ShmRing> attach(const std::string &path) {
+        int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+        if (fd < 0) return nullptr;
+        std::unique_ptr<ShmRing> ring(new ShmRing(fd));
+        if (!ring->map() || ring->hdr()->magic != SHM_RING_MAGIC ||
+            SHM_RING_DATA_OFFSET + ring->hdr()->capacity > ring->map_size_) return nullptr;
+        ring->hdr()->reader_pid.store((uint32_t)::getpid());
+        return ring;
+    }
+
+    // 다른 프로세스가 열 경로
+    std::string proc_path() const {
+        return "/proc/" + std::to_string(::getpid()) + "/fd/" + std::to_string(fd_);
+    }
+
+    // 소스: 빈 자리가 날 때까지 기다리며 전부 쓴다. 대상이 먼저 닫으면 false.
+    bool write(const char *data, std::size_t len) {
+        ShmRingHeader *h = hdr();
+        while (len > 0) {
+            uint32_t seq = h->tail_seq.load(std::memory_order_acquire);
+            uint64_t head = h->head.load(std::memory_order_relaxed);
+            uint64_t room = h->capacity - (head - h->tail.load(std::memory_order_acquire));
+            if (room == 0) {
+                if (h->state.load() & SHM_READER_CLOSED) return false;
+                if (!shm_peer_alive(h->reader_pid.load())) return false;
+                shm_futex_wait(h->tail_seq, seq);
+                continue;
+            }
+            uint64_t pos = head % h->capacity;
+            std::size_t n = (std::size_t)std::min<uint64_t>({len, room, h->capacity - pos});
+            std::memcpy(data_() + pos, data, n);
+            h->head.store(head + n, std::memory_order_release);
+            shm_futex_wake(h->head_seq);
+            data += n;
+            len -= n;
+        }
+        return true;
+    }
+
+    // 대상: 최대 max 바이트. 0 = 정상 끝, -1 = 소스 실패 (소스 프로세스가 죽은 경우 포함).
+    long read(char *out, std::size_t max) {
+        ShmRingHeader *h = hdr();
+        for (;;) {
+            uint32_t seq = h->head_seq.load(std::memory_order_acquire);
+            uint64_t tail = h->tail.load(std::memory_order_relaxed);
+            uint64_t avail = h->head.load(std::memory_order_acquire) - tail;
+            if (avail == 0) {
+                uint32_t st = h->state.load(std::memory_order_acquire);
+                if (st & SHM_WRITER_FAILED) return -1;
+                if (st & SHM_WRITER_DONE) {
+                    // done 을 보기 직전에 마지막 조각이 들어왔을 수 있다
+                    if (h->head.load(std::memory_order_acquire) == tail) return 0;
+                    continue;
+                }
+                if (!shm_peer_alive(h->writer_pid)) return -1;
+                shm_futex_wait(h->head_seq, seq);
+                continue;
+            }
+            uint64_t pos = tail % h->capacity;
+            std::size_t n = (std::size_t)std::min<uint64_t>({max, avail, h->capacity - pos});
+            std::memcpy(out, data_() + pos, n);
+            h->tail.store(tail + n, std::memory_order_release);
+            shm_futex_wake(h->tail_seq);
+            return (long)n;
+        }
+    }
+
+    void finish(bool ok) {
+        hdr()->state.fetch_or(ok ? SHM_WRITER_DONE : SHM_WRITER_FAILED);
+        shm_futex_wake(hdr()->head_seq);
+    }
+
+    void close_reader() {
+        hdr()->state.fetch_or(SHM_READER_CLOSED);
+        shm_futex_wake(hdr()->tail_seq);
+    }
+
+private:
+    explicit ShmRing(int fd) : fd_(fd) {}
+
+    bool map() {
+        struct stat st;
+        if (::fstat(fd_, &st) != 0 || (std::size_t)st.st_size <= SHM_RING_DATA_OFFSET) return false;
+        void *m = ::mmap(nullptr, (std::size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (m == MAP_FAILED) return false;
+        base_ = m;
+        map_size_ = (std::size_t)st.st_size;
+        return true;
+    }
+
+    ShmRingHeader *hdr() const { return (ShmRingHeader *)base_; }
+    char *data_() const { return (char *)base_ + SHM_RING_DATA_OFFSET; }
+
+    int fd_ = -1;
+    void *base_ = nullptr;
+    std::size_t map_size_ = 0;
+};
+
+// ---------------- HTTP download (수신 측) ----------------
+// "http://host:port/path" 분해. 실패 시 false.
+// "http+unix://<socket>/path" 면 host 에 socket 경로를 넣는다 (make_client 참고).
+bool parse_http_url(const std::string &url, std::string &host, int &port, std::string &path) {
+    if (starts_with(url, "http+unix://")) {
+        std::string rest = url.substr(12);
+        std::size_t pos = rest.find('/');
+        host = httplib::decode_uri_component(rest.substr(0, pos));
+        path = pos == std::string::npos ? "/" : rest.substr(pos);
+        port = 0;
+        return !host.empty() && host[0] == '/';
+    }
+    if (!starts_with(url, "http://")) return false;
+    std::string rest = url.substr(7);
+    std::size_t pos = rest.find('/');
+    std::string hostport = pos == std::string::npos ? rest : rest.substr(0, pos);
+    path = pos == std::string::npos ? "/" : rest.substr(pos);
+    host = hostport;
+    port = 80;
+    std::size_t colon = hostport.find(':');
+    if (colon != std::string::npos) {
+        host = hostport.substr(0, colon);
+        port = std::stoi(hostport.substr(colon + 1));
+    }
+    return !host.empty();
+}
+
+// 원격에서 받은 상대 경로가 저장 디렉토리 밖으로 나가지 않는지 확인
+bool is_safe_relative(const fs::path &rel) {
+    if (rel.empty() || rel.is_absolute() || rel.has_root_name()) return false;
+    for (auto &part : rel) {
+        if (part == "..") return false;
+    }
+    return true;
+}
+
+// 이미 연결된 cli 로 path 를 받아 dest 에 저장 (keep-alive 연결 재사용용)
+bool download_to_file(httplib::Client &cli,
+                      const std::string &path,
+                      const fs::path &dest,
+                      bool show_progress,
+                      const RateLimits &limits,
+                      uint64_t *bytes_out = nullptr) {
+    std::ofstream ofs(dest, std::ios::binary);
+    if (!ofs) {
+        std::cerr << "[DOWNLOAD] cannot open dest: " << dest << std::endl;
+        return false;
+    }
+
+    uint64_t total = 0;
+    uint64_t downloaded = 0;
+    // 소스가 구멍 있는 파일을 프레임으로 보내면 데이터 구간만 받아 제자리에 쓴다
+    std::unique_ptr<SparseWriter> sparse;
+
+    auto res = cli.Get(path, httplib::Headers{{"X-Accept-Sparse", "1"}},
+        [&](const httplib::Response &res) {
+            if (res.has_header("Content-Length")) {
+                total = std::stoull(res.get_header_value("Content-Length"));
+            }
+            if (res.get_header_value("Content-Type") == SPARSE_CONTENT_TYPE) {
+                sparse.reset(new SparseWriter(ofs));
+            }
+            return true;
+        },
+        [&](const char *data, size_t data_length) {
+            limits.consume(data_length);
+            if (sparse) {
+                if (!sparse->feed(data, data_length)) return false;
+            } else {
+                ofs.write(data, data_length);
+            }
+            downloaded += data_length;
+            if (show_progress && total) draw_progress(downloaded, total);
+            return true;
+        }
+    );
+    ofs.close();
+
+    if (!res || res->status != 200) {
+        std::cerr << "[DOWNLOAD] error: " << (res ? res->status : 0) << std::endl;
+        return false;
+    }
+    if (sparse) {
+        std::error_code ec;
+        if (!sparse->finished() || ofs.fail()) {
+            std::cerr << "[DOWNLOAD] sparse stream broken: " << dest << std::endl;
+            return false;
+        }
+        fs::resize_file(dest, sparse->logical_size(), ec); // 끝쪽 구멍
+        if (ec) return false;
+    }
+    if (show_progress && total) std::cout << std::endl;
+    if (bytes_out) *bytes_out = downloaded;
+    return true;
+}
+
+bool http_download_file(const std::string &host,
+                        int port,
+                        const std::string &path,
+                        const fs::path &dest,
+                        bool show_progress,
+                        const RateLimits &limits = RateLimits()) {
+    auto cli = make_client(host, port);
+    cli.set_read_timeout(300, 0);
+    cli.set_tcp_nodelay(true);
+    return download_to_file(cli, path, dest, show_progress, limits);
+}
+
+// ---------------- multi-source download (수신 측) ----------------
+// 같은 파일을 가진 여러 소스 URL 에서 서로 다른 구간을 동시에 받는다.
+//  - 파일을 MULTI_BLOCK_BYTES 블록으로 나누고, 소스마다 연결 몇 개가 공유 대기열에서 블록을 꺼낸다.
+//    빠른 소스가 더 많은 블록을 가져가므로 느린 소스에 일이 몰리지 않는다.
+//  - 대기열이 비면 놀고 있는 연결이 아직 받는 중인 블록을 같이 받아(끝물 가로채기)
+//    먼저 끝난 쪽이 이기고, 다른 쪽은 중단된다.
+//  - 블록을 MULTI_MAX_FAILURES 번 실패한 소스는 빠지고 그 블록은 다른 소스가 다시 받는다.
+const uint64_t MULTI_BLOCK_BYTES = 8ULL << 20;
+const int MULTI_MAX_FAILURES = 3;
+
+struct MultiSource {
+    std::string url;
+    std::string host;
+    std::string path;
+    int port = 0;
+    bool alive = true;
+    int failures = 0;
+    uint64_t bytes = 0;
+    uint64_t blocks = 0;
+};
+
+// HEAD 로 크기를 잰다
+bool probe_source_size(const MultiSource &src, uint64_t &size) {
+    auto cli = make_client(src.host, src.port);
+    cli.set_connection_timeout(5, 0);
+    cli.set_read_timeout(30, 0);
+    auto res = cli.Head(src.path);
+    if (!res || res->status != 200 || !res->has_header("Content-Length")) return false;
+    size = std::stoull(res->get_header_value("Content-Length"));
+    return true;
+}
+
+// urls 에서 dest 로. 결과 요약(소스별 바이트/블록)은 stats 에.
+bool multi_source_download(const std::vector<std::string> &urls, const fs::path &dest,
+                           bool show_progress, const RateLimits &limits,
+                           int conns_per_source, json &stats) {
+    std::vector<MultiSource> sources;
+    uint64_t size = 0;
+    bool have_size = false;
+    for (auto &u : urls) {
+        MultiSource s;
+        s.url = u;
+        uint64_t sz = 0;
+        if (!parse_http_url(u, s.host, s.port, s.path) || !probe_source_size(s, sz)) {
+            std::cerr << "[DOWNLOAD] source unavailable: " << u << std::endl;
+            continue;
+        }
+        if (have_size && sz != size) {
+            std::cerr << "[DOWNLOAD] source size mismatch: " << u << std::endl;
+            continue;
+        }
+        size = sz;
+        have_size = true;
+        sources.push_back(s);
+    }
+    stats = json::object();
+    if (sources.empty()) return false;
+
+    int fd = ::open(dest.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+    if (::ftruncate(fd, (off_t)size) != 0) {
+        ::close(fd);
+        return false;
+    }
+
+    struct Block {
+        uint64_t offset;
+        uint64_t length;
+        int owners;
+        std::size_t source; // 처음 가져간 소스
+    };
+    std::vector<Block> blocks;
+    for (uint64_t off = 0; off < size; off += MULTI_BLOCK_BYTES) {
+        blocks.push_back({off, std::min(MULTI_BLOCK_BYTES, size - off), 0, 0});
+    }
+    // 받는 중에 lock 없이 보므로 따로 atomic 으로
+    std::vector<std::atomic<bool>> finished(blocks.size());
+    std::mutex mu;
+    std::condition_variable cv;
+    std::vector<std::size_t> pending;
+    for (std::size_t i = blocks.size(); i-- > 0; ) pending.push_back(i); // 앞 블록부터 꺼내도록 역순
+    std::size_t done = 0;
+    bool aborted = false;
+    uint64_t stolen = 0;
+    std::atomic<uint64_t> received{0};
+
+    // 소스 si 가 받을 블록 하나 고르기 (lock 안). 없으면 blocks.size().
+    auto pick = [&](std::size_t si) -> std::size_t {
+        if (!pending.empty()) {
+            std::size_t b = pending.back();
+            pending.pop_back();
+            blocks[b].source = si;
+            return b;
+        }
+        for (std::size_t b = 0; b < blocks.size(); ++b) {
+            if (!finished[b] && blocks[b].owners == 1 && blocks[b].source != si) {
+                stolen++;
+                return b;
+            }
+        }
+        return blocks.size();
+    };
+
+    auto worker = [&](std::size_t si) {
+        MultiSource &src = sources[si];
+        auto cli = make_client(src.host, src.port);
+        cli.set_keep_alive(true);
+        cli.set_read_timeout(300, 0);
+        cli.set_tcp_nodelay(true);
+        for (;;) {
+            std::size_t b;
+            {
+                std::unique_lock<std::mutex> lk(mu);
+                for (;;) {
+                    if (aborted || done == blocks.size() || !src.alive) return;
+                    b = pick(si);
+                    if (b < blocks.size()) break;
+                    cv.wait(lk);
+                }
+                blocks[b].owners++;
+            }
+            Block &blk = blocks[b];
+            uint64_t got = 0;
+            std::string range = "bytes=" + std::to_string(blk.offset) + "-" +
+                                std::to_string(blk.offset + blk.length - 1);
+            bool write_ok = true;
+            auto res = cli.Get(src.path, httplib::Headers{{"Range", range}},
+                [&](const char *data, size_t len) {
+                    if (finished[b]) return false; // 다른 소스가 먼저 끝냄
+                    if (got + len > blk.length) return false;
+                    limits.consume(len);
+                    if (::pwrite(fd, data, len, (off_t)(blk.offset + got)) != (ssize_t)len) {
+                        write_ok = false;
+                        return false;
+                    }
+                    got += len;
+                    uint64_t total = received.fetch_add(len) + len;
+                    if (show_progress) draw_progress(std::min(total, size), size);
+                    return true;
+                });
+            bool ok = res && got == blk.length &&
+                      (res->status == 206 || (res->status == 200 && blk.length == size));
+            std::lock_guard<std::mutex> lk(mu);
+            blk.owners--;
+            if (ok && !finished[b]) {
+                finished[b] = true;
+                done++;
+                src.bytes += got;
+                src.blocks++;
+            } else if (!ok && !finished[b]) {
+                if (blk.owners == 0) pending.push_back(b);
+                if (!write_ok) {
+                    aborted = true; // 디스크 오류면 전체 중단 (소스 탓이 아님)
+                } else if (++src.failures >= MULTI_MAX_FAILURES) {
+                    src.alive = false;
+                    std::cerr << "[DOWNLOAD] source dropped: " << src.url << std::endl;
+                }
+            }
+            cv.notify_all();
+        }
+    };
+
+    int per = std::max(1, std::min(conns_per_source, 8));
+    std::vector<std::thread> ths;
+    for (std::size_t si = 0; si < sources.size(); ++si) {
+        for (int c = 0; c < per; ++c) ths.emplace_back(worker, si);
+    }
+    for (auto &t : ths) t.join();
+    if (show_progress) std::cout << std::endl;
+    bool closed = ::close(fd) == 0;
+
+    json per_source = json::array();
+    for (auto &s : sources) {
+        per_source.push_back({{"url", s.url}, {"bytes", s.bytes}, {"blocks", s.blocks},
+                              {"failures", s.failures}, {"alive", s.alive}});
+    }
+    stats["size"] = size;
+    stats["blocks"] = blocks.size();
+    stats["stolen"] = stolen;
+    stats["sources"] = std::move(per_source);
+    return closed && done == blocks.size();
+}
+
+// ---------------- batch download (수신 측) ----------------
+// /api/download-batch 본체. 목록 항목(id, path) 을 connections 개의 keep-alive 연결이
+// 공유 커서에서 하나씩 꺼내 GET <base>/file/<id> 로 받아 save_dir/path 에 저장한다.
+// next 는 목록을 앞에서부터 하나씩 내어 주는 함수 (lock 안에서 호출됨), count 는 항목 수.
+// apply_meta 면 항목의 mode/mtime 을 저장한 파일에 입힌다
+// (바이너리 manifest, 또는 mode/mtimeNs 가 다 있는 JSON 목록).
+json batch_download(const std::string &host, int port, const fs::path &save_dir,
+                    const std::function<bool(ManifestEntry &)> &next, std::size_t count,
+                    bool apply_meta, int connections, const RateLimits &limits) {
+    // 결과 칸은 실제로 읽은 항목만큼 만든다 (count 는 manifest 헤더 값이라 그대로 믿지 않음).
+    // deque 는 뒤에 붙여도 기존 칸의 참조가 그대로라 각 워커가 락 밖에서 자기 칸을 채운다.
+    std::deque<json> results;
+    std::mutex cursor_mu;
+    std::size_t cursor = 0;
+    std::atomic<uint64_t> total_bytes{0};
+    std::atomic<std::size_t> failed{0};
+
+    auto worker = [&]() {
+        auto cli = make_client(host, port);
+        cli.set_keep_alive(true);
+        cli.set_read_timeout(300, 0);
+        cli.set_tcp_nodelay(true);
+        fs::path last_dir;
+        ManifestEntry f;
+
+        for (;;) {
+            json *slot;
+            {
+                std::lock_guard<std::mutex> lk(cursor_mu);
+                if (cursor >= count || !next(f)) break;
+                cursor++;
+                results.emplace_back();
+                slot = &results.back();
+            }
+            uint64_t id = f.id;
+            fs::path rel = f.path;
+            json r;
+            r["id"] = id;
+            if (!is_safe_relative(rel)) {
+                r["ok"] = false;
+                r["error"] = "unsafe path";
+                failed++;
+                *slot = std::move(r);
+                continue;
+            }
+            // 항목 하나의 예외 (ensure_dir 실패 등) 가 스레드 밖으로 나가면 노드가 죽는다
+            try {
+                fs::path dest = save_dir / rel;
+                if (dest.parent_path() != last_dir) {
+                    last_dir = dest.parent_path();
+                    ensure_dir(last_dir);
+                }
+                uint64_t got = 0;
+                if (download_to_file(cli, "/file/" + std::to_string(id), dest, false, limits, &got)) {
+                    if (apply_meta) apply_file_meta(dest, f.mode, f.mtime_ns);
+                    r["ok"] = true;
+                    r["saved"] = dest.string();
+                    total_bytes += got;
+                } else {
+                    r["ok"] = false;
+                    r["error"] = "download failed";
+                    failed++;
+                }
+            } catch (const std::exception &ex) {
+                last_dir.clear();
+                r["ok"] = false;
+                r["error"] = std::string("exception: ") + ex.what();
+                failed++;
+            }
+            *slot = std::move(r);
+        }
+    };
+
+    int nconn = std::max(1, std::min(connections, (int)std::max<std::size_t>(count, 1)));
+    std::vector<std::thread> ths;
+    for (int c = 1; c < nconn; ++c) ths.emplace_back(worker);
+    worker();
+    for (auto &t : ths) t.join();
+
+    // 목록이 count 보다 짧게 끝났으면(깨진 manifest) partial
+    json out;
+    out["status"] = failed || cursor < count ? "partial" : "ok";
+    out["count"] = count;
+    out["failed"] = failed.load();
+    out["bytes"] = total_bytes.load();
+    out["results"] = json::array();
+    for (auto &r : results) out["results"].push_back(std::move(r));
+    return out;
+}
+
+// ---------------- Pack mode ----------------
+enum class PackMode { NONE, TAR, GZ, TARGZ };
+
+struct ArchiveInfo {
+    fs::path archive_path;
+    std::string archive_name;
+    bool cleanup = false;
+};
+
+// ---------------- prepare_archive (송신 측) ----------------
+// 규칙:
+//  - 파일:
+//      NONE  -> 그대로 전송
+//      TAR   -> .tar (tar 사용)
+//      GZ    -> .gz (gzip 사용)
+//      TARGZ -> .tar.gz (tar -czf 사용)
+//  - 폴더:
+//      NONE  -> RAW 디렉토리 전송 (prepare_archive 사용 안 함; /api/send-file 에서 처리)
+//      TAR   -> .tar
+//      GZ    -> .tar.gz
+//      TARGZ -> .tar.gz
+ArchiveInfo prepare_archive(const fs::path &input, PackMode mode, bool /*auto_extract*/) {
+    ArchiveInfo info;
+    info.archive_path = input;
+    info.archive_name = input.filename().string();
+    info.cleanup = false;
+
+    bool is_dir = fs::is_directory(input);
+    bool is_file = fs::is_regular_file(input);
+    if (!is_dir && !is_file) {
+        throw std::runtime_error("path is neither file nor directory");
+    }
+
+    // 파일 + NONE -> 그대로
+    if (is_file && mode == PackMode::NONE) {
+        return info;
+    }
+
+    fs::path tmp = fs::temp_directory_path();
+    std::string base = input.filename().string();
+
+    // 폴더 + NONE 은 RAW 모드에서 처리하므로 여기선 사용되지 않지만,
+    // 이전 호환성을 위해 남겨 둔다.
+    if (is_dir && mode == PackMode::NONE) {
+        // (이 코드 경로는 현재 로직에서는 호출되지 않음)
+        check_tools_for_pack(true, false); // tar 필요
+        info.archive_path = tmp / (base + ".tar");
+        info.archive_name = info.archive_path.filename().string();
+        std::string cmd = "cd \"" + input.parent_path().string() +
+                          "\" && tar -cf \"" + info.archive_path.string() +
+                          "\" \"" + base + "\"";
+        if (run_command(cmd) != 0) {
+            throw std::runtime_error("tar failed");
+        }
+        info.cleanup = true;
+        return info;
+    }
+
+    // 그 외: mode 에 따라 분기
+    if (is_dir) {
+        if (mode == PackMode::TAR) {
+            check_tools_for_pack(true, false);
+            info.archive_path = tmp / (base + ".tar");
+            info.archive_name = info.archive_path.filename().string();
+            std::string cmd = "cd \"" + input.parent_path().string() +
+                              "\" && tar -cf \"" + info.archive_path.string() +
+                              "\" \"" + base + "\"";
+            if (run_command(cmd) != 0) {
+                throw std::runtime_error("tar failed");
+            }
+        } else if (mode == PackMode::GZ || mode == PackMode::TARGZ) {
+            // 폴더의 경우 GZ, TARGZ 모두 tar.gz
+            check_tools_for_pack(true, false); // tar 만 있으면 tar -czf 가능
+            info.archive_path = tmp / (base + ".tar.gz");
+            info.archive_name = info.archive_path.filename().string();
+            std::string cmd = "cd \"" + input.parent_path().string() +
+                              "\" && tar -czf \"" + info.archive_path.string() +
+                              "\" \"" + base + "\"";
+            if (run_command(cmd) != 0) {
+                throw std::runtime_error("tar.gz failed");
+            }
+        }
+    } else { // is_file
+        if (mode == PackMode::TAR) {
+            check_tools_for_pack(true, false);
+            info.archive_path = tmp / (base + ".tar");
+            info.archive_name = info.archive_path.filename().string();
+            std::string cmd = "cd \"" + input.parent_path().string() +
+                              "\" && tar -cf \"" + info.archive_path.string() +
+                              "\" \"" + base + "\"";
+            if (run_command(cmd) != 0) {
+                throw std::runtime_error("tar failed");
+            }
+        } else if (mode == PackMode::GZ) {
+            check_tools_for_pack(false, true); // gzip 필요
+            info.archive_path = tmp / (base + ".gz");
+            info.archive_name = info.archive_path.filename().string();
+            std::string cmd = "gzip -c \"" + input.string() +
+                              "\" > \"" + info.archive_path.string() + "\"";
+            if (run_command(cmd) != 0) {
+                throw std::runtime_error("gzip failed");
+            }
+        } else if (mode == PackMode::TARGZ) {
+            check_tools_for_pack(true, false);
+            info.archive_path = tmp / (base + ".tar.gz");
+            info.archive_name = info.archive_path.filename().string();
+            std::string cmd = "cd \"" + input.parent_path().string() +
+                              "\" && tar -czf \"" + info.archive_path.string() +
+                              "\" \"" + base + "\"";
+            if (run_command(cmd) != 0) {
+                throw std::runtime_error("tar.gz failed");
+            }
+        }
+    }
+
+    info.cleanup = true;
+    return info;
+}
+
+// ---------------- data server (송신 측) ----------------
+const size_t DATA_CHUNK_SIZE = 256 * 1024;
+
+// res 에 구멍 있는 파일의 프레임 본문 provider 를 건다 (sparse file 참고).
+// 프레임 머리들은 미리 만들어 두고, 스트림 offset 으로 어느 구간인지 찾아 이어서 보낸다.
+void set_sparse_content(httplib::Response &res2, std::shared_ptr<std::ifstream> ifs_ptr,
+                        uint64_t size, const std::vector<Extent> &extents,
+                        const RateLimits &limits) {
+    // seg: 스트림 시작 위치, 길이, 파일 offset (머리면 head 의 위치, 파일 offset 은 -1)
+    struct Seg {
+        uint64_t start;
+        uint64_t length;
+        int64_t file_off;
+        std::size_t head_off;
+    };
+    auto head = std::make_shared<std::string>();
+    auto segs = std::make_shared<std::vector<Seg>>();
+    auto add_head = [&](std::size_t len) {
+        uint64_t start = segs->empty() ? 0 : segs->back().start + segs->back().length;
+        segs->push_back({start, len, -1, head->size() - len});
+    };
+    put_le(*head, SPARSE_MAGIC, 4);
+    put_le(*head, size, 8);
+    add_head(SPARSE_HEADER_SIZE);
+    for (auto &e : extents) {
+        put_le(*head, e.offset, 8);
+        put_le(*head, e.length, 8);
+        add_head(SPARSE_EXTENT_HEADER_SIZE);
+        segs->push_back({segs->back().start + segs->back().length, e.length, (int64_t)e.offset, 0});
+    }
+    put_le(*head, size, 8);
+    put_le(*head, 0, 8);
+    add_head(SPARSE_EXTENT_HEADER_SIZE);
+
+    uint64_t total = sparse_stream_size(extents);
+    res2.headers.erase("Content-Type"); // 호출 측이 붙인 octet-stream 대신 프레임 형식으로
+    res2.set_header("X-Sparse-Size", std::to_string(size));
+    res2.set_content_provider(
+        total, SPARSE_CONTENT_TYPE,
+        [ifs_ptr, head, segs, limits](size_t offset, size_t length, httplib::DataSink &sink) {
+            auto it = std::upper_bound(segs->begin(), segs->end(), (uint64_t)offset,
+                                       [](uint64_t o, const Seg &s) { return o < s.start; });
+            if (it == segs->begin()) return false;
+            const Seg &seg = *(it - 1);
+            uint64_t in_seg = offset - seg.start;
+            size_t want = (size_t)std::min<uint64_t>({length, DATA_CHUNK_SIZE, seg.length - in_seg});
+            if (seg.file_off < 0) return sink.write(head->data() + seg.head_off + in_seg, want);
+            std::vector<char> buf(want);
+            ifs_ptr->clear();
+            ifs_ptr->seekg((std::streamoff)(seg.file_off + in_seg), std::ios::beg);
+            ifs_ptr->read(buf.data(), (std::streamsize)want);
+            auto read_bytes = (size_t)ifs_ptr->gcount();
+            if (read_bytes == 0) return false;
+            limits.consume(read_bytes);
+            return sink.write(buf.data(), read_bytes);
+        });
+}
+
+// res 에 파일 본문 provider 를 건다. 요청마다 자기 ifstream 을 열어 동시 요청끼리 seek 이 섞이지 않게 한다.
+// sparse_ok (요청에 X-Accept-Sparse: 1) 이고 파일에 구멍이 있으면 데이터 구간만 프레임으로 보낸다.
+bool set_file_content(httplib::Response &res2, const fs::path &path, uint64_t size,
+                      const RateLimits &limits, bool sparse_ok = false) {
+    auto ifs_ptr = std::make_shared<std::ifstream>(path, std::ios::binary);
+    if (!ifs_ptr->is_open()) return false;
+    std::vector<Extent> extents;
+    if (sparse_ok && sparse_extents(path, size, extents)) {
+        set_sparse_content(res2, ifs_ptr, size, extents, limits);
+        return true;
+    }
+    res2.set_content_provider(
+        size,
+        "application/octet-stream",
+        [ifs_ptr, limits](size_t offset, size_t length, httplib::DataSink &sink) {
+            size_t want = std::min(length, DATA_CHUNK_SIZE);
+            std::vector<char> buf(want);
+            ifs_ptr->clear();
+            ifs_ptr->seekg((std::streamoff)offset, std::ios::beg);
+            ifs_ptr->read(buf.data(), (std::streamsize)want);
+            auto read_bytes = (size_t)ifs_ptr->gcount();
+            if (read_bytes == 0) return false;
+            limits.consume(read_bytes);
+            sink.write(buf.data(), read_bytes);
+            return true;
+        }
+    );
+    return true;
+}
+
+// svr 에 GET /download 를 붙인다. 요청된 길이를 한 번에 읽지 않고
+// DATA_CHUNK_SIZE 단위로 읽어 보내며, 조각마다 limits 의 버킷을 통과시킨다.
+bool serve_file_download(httplib::Server &svr, const ArchiveInfo &ai, uint64_t size,
+                         const RateLimits &limits) {
+    {
+        std::ifstream probe(ai.archive_path, std::ios::binary);
+        if (!probe.is_open()) return false;
+    }
+
+    fs::path path = ai.archive_path;
+    std::string name = ai.archive_name;
+    svr.Get("/download", [path, size, name, limits](const httplib::Request &req, httplib::Response &res2) {
+        res2.set_header("Content-Type", "application/octet-stream");
+        res2.set_header("Content-Disposition", "attachment; filename=\"" + name + "\"");
+        bool sparse_ok = req.get_header_value("X-Accept-Sparse") == "1";
+        if (!set_file_content(res2, path, size, limits, sparse_ok)) res2.status = 500;
+    });
+    return true;
+}
+
+// GET /file/<id> : paths[id] 를 전송. RAW 배치 전송에서 데이터 서버 하나로 여러 파일을 서빙한다.
+void serve_file_list(httplib::Server &svr,
+                     std::shared_ptr<const std::vector<fs::path>> paths,
+                     const RateLimits &limits) {
+    svr.set_keep_alive_max_count(1000000); // 배치 동안 연결 하나로 계속 받도록
+    svr.Get(R"(/file/(\d+))", [paths, limits](const httplib::Request &req, httplib::Response &res2) {
+        std::size_t id = std::stoull(req.matches[1].str());
+        if (id >= paths->size()) {
+            res2.status = 404;
+            return;
+        }
+        const fs::path &path = (*paths)[id];
+        std::error_code ec;
+        auto size = fs::file_size(path, ec);
+        bool sparse_ok = req.get_header_value("X-Accept-Sparse") == "1";
+        if (ec || !set_file_content(res2, path, (uint64_t)size, limits, sparse_ok)) {
+            res2.status = 404;
+        }
+    });
+}
+
+// ---------------- data port pool (송신 측) ----------------
+// 전송마다 데이터 서버 포트를 따로 잡는다.
+//  - 범위가 설정되어 있으면(--data-port-range 9000-9100) 그 안에서 비어 있는 포트를 순환 할당
+//  - 범위가 없으면 요청의 dataPort 를 먼저 시도하고, 사용 중이면 OS 임시 포트로 대체
+//    (dataPort 0 이면 바로 임시 포트)
+class DataPortPool {
+public:
+    // 잡은 포트를 소멸 시 반환
+    class Lease {
+    public:
+        Lease(DataPortPool *pool, int port) : pool_(pool), port_(port) {}
+        Lease(const Lease &) = delete;
+        Lease &operator=(const Lease &) = delete;
+        ~Lease() { if (pool_) pool_->release(port_); }
+        int port() const { return port_; }
+    private:
+        DataPortPool *pool_;
+        int port_;
+    };
+
+    void configure(int lo, int hi) {
+        std::lock_guard<std::mutex> lk(mu_);
+        lo_ = lo;
+        hi_ = hi;
+        next_ = lo;
+    }
+
+    // svr 를 host 의 데이터 포트에 bind (listen 대기열까지 열린 상태). 실패 시 nullptr.
+    std::unique_ptr<Lease> bind(httplib::Server &svr, const std::string &host, int preferred) {
+        std::lock_guard<std::mutex> lk(mu_);
+        if (lo_ > 0) {
+            int span = hi_ - lo_ + 1;
+            for (int i = 0; i < span; ++i) {
+                int port = lo_ + (next_ - lo_ + i) % span;
+                if (in_use_.count(port)) continue;
+                if (try_bind(svr, host, port)) {
+                    next_ = port + 1 > hi_ ? lo_ : port + 1;
+                    in_use_.insert(port);
+                    return std::make_unique<Lease>(this, port);
+                }
+            }
+            return nullptr;
+        }
+        if (preferred > 0 && !in_use_.count(preferred) && try_bind(svr, host, preferred)) {
+            in_use_.insert(preferred);
+            return std::make_unique<Lease>(this, preferred);
+        }
+        int port = svr.bind_to_any_port(host);
+        if (port <= 0) return nullptr;
+        in_use_.insert(port);
+        return std::make_unique<Lease>(this, port);
+    }
+
+private:
+    static bool try_bind(httplib::Server &svr, const std::string &host, int port) {
+        if (svr.bind_to_port(host, port)) return true;
+        svr.stop(); // bind 실패로 막힌(decommissioned) 상태를 풀어 다음 포트 시도를 허용
+        return false;
+    }
+
+    void release(int port) {
+        std::lock_guard<std::mutex> lk(mu_);
+        in_use_.erase(port);
+    }
+
+    std::mutex mu_;
+    int lo_ = 0, hi_ = 0, next_ = 0;
+    std::set<int> in_use_;
+};
+
+DataPortPool g_data_ports;
+
+// 전송 하나 동안 떠 있는 데이터 서버.
+// start() 가 돌아온 시점에는 포트가 bind/listen 되어 있고 accept 루프도 돌고 있으므로,
+// 그 다음에 대상에게 /api/download-file 을 보내야 수신 측 연결이 거절되지 않는다.
+// unix_socket 이면 (같은 머신 대상 + --uds-dir) TCP 포트 대신 uds 디렉토리의 socket 에서 듣는다.
+class DataServer {
+public:
+    DataServer() : svr_(std::make_shared<httplib::Server>()) {
+        svr_->set_tcp_nodelay(true); // 작은 파일 응답 끝에서 Nagle 지연 방지
+    }
+    DataServer(const DataServer &) = delete;
+    DataServer &operator=(const DataServer &) = delete;
+    ~DataServer() { stop(); }
+
+    httplib::Server &svr() { return *svr_; }
+
+    bool start(const std::string &host, int preferred_port, bool unix_socket = false) {
+        auto t0 = std::chrono::steady_clock::now();
+        if (unix_socket && !g_uds_dir.empty()) {
+            static std::atomic<uint64_t> seq{0};
+            ensure_dir(g_uds_dir);
+            sock_ = g_uds_dir / ("data-" + std::to_string(::getpid()) + "-" +
+                                 std::to_string(seq.fetch_add(1)) + ".sock");
+            if (!listen_unix(*svr_, sock_)) {
+                sock_.clear();
+                return false;
+            }
+        } else {
+            lease_ = g_data_ports.bind(*svr_, host, preferred_port);
+            if (!lease_) return false;
+            port_ = lease_->port();
+        }
+        auto svr = svr_;
+        th_ = std::thread([svr]() { svr->listen_after_bind(); });
+        svr_->wait_until_ready();
+        bind_ms_ = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - t0).count();
+        return svr_->is_running();
+    }
+
+    void stop() {
+        if (th_.joinable()) {
+            svr_->stop();
+            th_.join();
+        }
+        lease_.reset();
+        if (!sock_.empty()) {
+            std::error_code ec;
+            fs::remove(sock_, ec);
+        }
+    }
+
+    // 대상이 받아 갈 URL. host 는 TCP 일 때 소스 주소.
+    std::string url(const std::string &host, const std::string &path) const {
+        if (!sock_.empty()) return unix_url(sock_, path);
+        return "http://" + host + ":" + std::to_string(port_) + path;
+    }
+
+    int port() const { return port_; }
+    double bind_ms() const { return bind_ms_; }
+
+private:
+    std::shared_ptr<httplib::Server> svr_;
+    std::unique_ptr<DataPortPool::Lease> lease_;
+    std::thread th_;
+    int port_ = 0;
+    fs::path sock_;
+    double bind_ms_ = 0;
+};
+
+double elapsed_ms(std::chrono::steady_clock::time_point since) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - since).count();
+}
+
+// ---------------- bundle (작은 파일 묶음) ----------------
+// 작은 파일 여러 개를 HTTP 응답 하나로 이어 보내는 프레임 형식 (little-endian).
+//   record = magic u32 "P2PB" | path_len u16 | mode u32 | mtime_ns i64 | length u64 | path | payload
+//   path_len == 0 인 레코드가 묶음의 끝.
+//   magic 이 "P2PE" 인 레코드(length 0)는 바로 앞 레코드를 무효로 한다 (송신 측이 파일을 끝까지 못 읽음).
+// 송신 측은 파일을 읽는 대로 흘려 보내고 수신 측은 받는 대로 제자리에 풀어 쓰므로
+// tar 도, 양쪽 임시 파일도 필요 없다.
+const uint32_t BUNDLE_MAGIC = 0x42503250;      // "P2PB"
+const uint32_t BUNDLE_FAIL_MAGIC = 0x45503250; // "P2PE"
+const std::size_t BUNDLE_HEADER_SIZE = 4 + 2 + 4 + 8 + 8;
+
+struct BundleEntry {
+    fs::path src;     // 송신 측 경로
+    std::string rel;  // 수신 측 saveDir 기준 상대 경로
+    uint64_t size = 0;
+    uint32_t mode = 0644;
+    int64_t mtime_ns = 0;
+};
+
+BundleEntry make_bundle_entry(const fs::path &src, const std::string &rel) {
+    BundleEntry e;
+    e.src = src;
+    e.rel = rel;
+    struct stat st;
+    if (::stat(src.c_str(), &st) == 0) {
+        e.size = (uint64_t)st.st_size;
+        e.mode = (uint32_t)(st.st_mode & 07777);
+        e.mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    }
+    return e;
+}
+
+std::string bundle_header(const std::string &rel, uint32_t mode, int64_t mtime_ns, uint64_t length,
+                          uint32_t magic = BUNDLE_MAGIC) {
+    std::string h;
+    h.reserve(BUNDLE_HEADER_SIZE + rel.size());
+    put_le(h, magic, 4);
+    put_le(h, rel.size(), 2);
+    put_le(h, mode, 4);
+    put_le(h, (uint64_t)mtime_ns, 8);
+    put_le(h, length, 8);
+    h += rel;
+    return h;
+}
+
+// 송신 측: entries 를 순서대로 프레임으로 만들어 chunked provider 에 흘려 보낸다.
+// 헤더의 length 는 묶음 계획 시점의 크기다. 그 사이 파일을 못 열게 됐거나 크기가 바뀌었으면
+// 프레임 경계는 지키도록 0 으로 채우거나 잘라 보내고, 뒤에 실패 레코드를 붙여 대상이 지우게 한다.
+class BundleWriter {
+public:
+    explicit BundleWriter(std::vector<BundleEntry> entries) : entries_(std::move(entries)) {}
+
+    // 다음 조각을 sink 로 쓴다. 끝 레코드까지 다 보내면 sink.done().
+    bool write_next(httplib::DataSink &sink, const RateLimits &limits) {
+        if (idx_ == entries_.size()) {
+            std::string end = bundle_header("", 0, 0, 0);
+            sink.write(end.data(), end.size());
+            sink.done();
+            return true;
+        }
+        const BundleEntry &e = entries_[idx_];
+        if (!in_payload_) {
+            std::string h = bundle_header(e.rel, e.mode, e.mtime_ns, e.size);
+            ifs_ = std::ifstream(e.src, std::ios::binary);
+            remaining_ = e.size;
+            in_payload_ = true;
+            broken_ = !ifs_;
+            if (!sink.write(h.data(), h.size())) return false;
+        }
+        if (remaining_ > 0) {
+            std::size_t want = (std::size_t)std::min<uint64_t>(remaining_, DATA_CHUNK_SIZE);
+            buf_.resize(want);
+            std::size_t got = 0;
+            if (ifs_) {
+                ifs_.read(buf_.data(), (std::streamsize)want);
+                got = (std::size_t)ifs_.gcount();
+            }
+            if (got < want) {
+                std::fill(buf_.begin() + got, buf_.end(), 0);
+                broken_ = true;
+            }
+            limits.consume(want);
+            if (!sink.write(buf_.data(), want)) return false;
+            remaining_ -= want;
+        }
+        if (remaining_ == 0) {
+            if (!broken_ && ifs_.peek() != std::char_traits<char>::eof()) broken_ = true; // 그 사이 늘어남
+            ifs_.close();
+            in_payload_ = false;
+            idx_++;
+            if (broken_) {
+                std::cerr << "[BUNDLE] 읽기 실패/크기 바뀜: " << e.src << "\n";
+                std::string f = bundle_header(e.rel, 0, 0, 0, BUNDLE_FAIL_MAGIC);
+                if (!sink.write(f.data(), f.size())) return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    std::vector<BundleEntry> entries_;
+    std::size_t idx_ = 0;
+    bool in_payload_ = false;
+    bool broken_ = false;
+    uint64_t remaining_ = 0;
+    std::ifstream ifs_;
+    std::vector<char> buf_;
+};
+
+// 수신 측: 바이트 흐름을 받아 레코드 단위로 save_dir 아래에 풀어 쓴다.
+class BundleReader {
+public:
+    explicit BundleReader(fs::path save_dir) : save_dir_(std::move(save_dir)) {}
+
+    bool feed(const char *data, std::size_t len) {
+        while (len > 0) {
+            if (finished_) return false; // 끝 레코드 뒤의 쓰레기
+            if (!in_payload_) {
+                std::size_t need = header_need();
+                std::size_t take = std::min(len, need - head_.size());
+                head_.append(data, take);
+                data += take;
+                len -= take;
+                if (head_.size() == need && !start_record()) return false;
+                continue;
+            }
+            std::size_t take = (std::size_t)std::min<uint64_t>(len, remaining_);
+            if (ofs_) ofs_.write(data, (std::streamsize)take);
+            data += take;
+            len -= take;
+            remaining_ -= take;
+            bytes_ += take;
+            if (remaining_ == 0) finish_record();
+        }
+        return true;
+    }
+
+    bool finished() const { return finished_; }
+    uint64_t bytes() const { return bytes_; }
+    const std::vector<json> &results() const { return results_; }
+
+private:
+    // 고정 헤더를 다 받은 뒤에는 path 길이만큼 더 받아야 한다
+    std::size_t header_need() const {
+        if (head_.size() < BUNDLE_HEADER_SIZE) return BUNDLE_HEADER_SIZE;
+        return BUNDLE_HEADER_SIZE + (std::size_t)get_le((const unsigned char *)head_.data() + 4, 2);
+    }
+
+    bool start_record() {
+        auto *h = (const unsigned char *)head_.data();
+        uint32_t magic = (uint32_t)get_le(h, 4);
+        if (magic != BUNDLE_MAGIC && magic != BUNDLE_FAIL_MAGIC) return false;
+        std::size_t path_len = (std::size_t)get_le(h + 4, 2);
+        if (path_len == 0 && magic == BUNDLE_MAGIC) {
+            finished_ = true;
+            return true;
+        }
+        if (head_.size() < BUNDLE_HEADER_SIZE + path_len) return true; // path 대기
+        if (magic == BUNDLE_FAIL_MAGIC) {
+            // 앞 레코드 무효: 받은 파일을 지우고 실패로 바꾼다
+            std::string rel = head_.substr(BUNDLE_HEADER_SIZE, path_len);
+            head_.clear();
+            if (results_.empty() || results_.back().value("path", "") != rel) return false;
+            json &r = results_.back();
+            if (r.value("ok", false)) {
+                std::error_code ec;
+                fs::remove(cur_dest_, ec);
+                r.erase("saved");
+                r["ok"] = false;
+            }
+            r["error"] = "source read failed";
+            return true;
+        }
+        mode_ = (uint32_t)get_le(h + 6, 4);
+        mtime_ns_ = (int64_t)get_le(h + 10, 8);
+        remaining_ = get_le(h + 18, 8);
+        rel_ = head_.substr(BUNDLE_HEADER_SIZE, path_len);
+        head_.clear();
+        in_payload_ = true;
+
+        fs::path rel(rel_);
+        cur_ok_ = is_safe_relative(rel);
+        cur_dest_ = save_dir_ / rel;
+        if (cur_ok_) {
+            if (cur_dest_.parent_path() != last_dir_) {
+                last_dir_ = cur_dest_.parent_path();
+                ensure_dir(last_dir_);
+            }
+            ofs_ = std::ofstream(cur_dest_, std::ios::binary | std::ios::trunc);
+            cur_ok_ = (bool)ofs_;
+        }
+        if (remaining_ == 0) finish_record();
+        return true;
+    }
+
+    void finish_record() {
+        json r;
+        r["path"] = rel_;
+        if (cur_ok_) {
+            ofs_.close();
+            cur_ok_ = !ofs_.fail();
+        }
+        if (cur_ok_) {
+            apply_file_meta(cur_dest_, mode_, mtime_ns_);
+            r["ok"] = true;
+            r["saved"] = cur_dest_.string();
+        } else {
+            r["ok"] = false;
+            r["error"] = is_safe_relative(fs::path(rel_)) ? "write failed" : "unsafe path";
+        }
+        results_.push_back(std::move(r));
+        in_payload_ = false;
+    }
+
+    fs::path save_dir_;
+    fs::path last_dir_;
+    std::string head_;
+    bool in_payload_ = false;
+    bool finished_ = false;
+    std::string rel_;
+    uint32_t mode_ = 0;
+    int64_t mtime_ns_ = 0;
+    uint64_t remaining_ = 0;
+    uint64_t bytes_ = 0;
+    fs::path cur_dest_;
+    bool cur_ok_ = false;
+    std::ofstream ofs_;
+    std::vector<json> results_;
+};
+
+// GET /bundle/<n> : bundles[n] 을 프레임 흐름으로 전송
+void serve_bundles(httplib::Server &svr,
+                   std::shared_ptr<const std::vector<std::vector<BundleEntry>>> bundles,
+                   const RateLimits &limits) {
+    svr.Get(R"(/bundle/(\d+))", [bundles, limits](const httplib::Request &req, httplib::Response &res2) {
+        std::size_t n = std::stoull(req.matches[1].str());
+        if (n >= bundles->size()) {
+            res2.status = 404;
+            return;
+        }
+        auto writer = std::make_shared<BundleWriter>((*bundles)[n]);
+        res2.set_chunked_content_provider(
+            "application/x-p2p-bundle",
+            [writer, limits](size_t, httplib::DataSink &sink) {
+                return writer->write_next(sink, limits);
+            });
+    });
+}
+
+// 수신 측: url 의 묶음을 받아 save_dir 에 푼다
+json bundle_download(const std::string &host, int port, const std::string &path,
+                     const fs::path &save_dir, const RateLimits &limits) {
+    auto cli = make_client(host, port);
+    cli.set_read_timeout(300, 0);
+    cli.set_tcp_nodelay(true);
+
+    BundleReader reader(save_dir);
+    bool framing_ok = true;
+    auto res = cli.Get(path.c_str(), [&](const char *data, size_t len) {
+        limits.consume(len);
+        if (!reader.feed(data, len)) {
+            framing_ok = false;
+            return false;
+        }
+        return true;
+    });
+
+    std::size_t failed = 0;
+    for (auto &r : reader.results()) {
+        if (!r.value("ok", false)) failed++;
+    }
+    json out;
+    bool ok = res && res->status == 200 && framing_ok && reader.finished();
+    out["status"] = !ok ? "error" : (failed ? "partial" : "ok");
+    if (!ok) {
+        out["error"] = !res ? "no response"
+                     : res->status != 200 ? "http " + std::to_string(res->status)
+                     : "broken bundle stream";
+    }
+    out["count"] = reader.results().size();
+    out["failed"] = failed;
+    out["bytes"] = reader.bytes();
+    out["results"] = reader.results();
+    return out;
+}
+
+// ---------------- RAW directory transfer (송신 측) ----------------
+// 폴더 + packMode NONE + autoExtract false 일 때, tar/gzip 없이 폴더 안의 파일을 개별로 보낸다.
+//  - 배치 모드(기본): 데이터 서버 하나가 /file/<id> 로 모든 파일을 서빙하고,
+//    대상에는 /api/download-batch 로 batch_size 개씩 목록을 넘긴다.
+//  - 대상이 배치 API 를 모르면(404) 파일마다 /api/download-file 을 보내는 기존 방식으로 되돌아간다.
+//  - parallel 개의 워커가 공유 작업 큐에서 작업 단위를 하나씩 가져간다. 큰 파일부터 배치하고
+//    큰 파일은 단독 단위가 되므로, 몇 개의 거대한 파일이 마지막에 남아 꼬리를 늘리지 않는다.
+//  - bundle 모드면 bundle_threshold 이하 파일은 수집 순서대로 묶음(/bundle/<n>) 단위가 되어
+//    /api/download-bundle 한 번에 풀린다. 대상이 모르면 배치 → 파일별 순으로 되돌아간다.
+//  - sync 모드면 먼저 대상의 /api/manifest 로 기존 파일 목록을 받아, 경로/크기/mtime
+//    (syncHash 면 경로/크기/내용 해시) 가 같은 파일은 보내지 않는다.
+//  - 같은 inode 를 가리키는 hardlink (dedupe 면 내용이 같은 파일도) 는 처음 것만 보내고,
+//    나머지는 window 전송 뒤 /api/link-files 로 대상에서 link/복사로 만든다.
+struct RawFile {
+    fs::path path;     // 소스 경로
+    fs::path relative; // 최상위 폴더명을 포함한 상대 경로 (대상 saveDir 기준)
+    uint64_t size = 0;
+    int64_t mtime_ns = 0;
+    uint32_t mode = 0644;
+    uint64_t dev = 0, ino = 0; // 로컬 복사 때 대상이 같은 파일을 보는지 확인용
+    fs::path link_to;  // 비어 있지 않으면 이 relative 의 사본 (본문 전송 안 함)
+    bool hard_link = false;
+};
+
+// 작업 단위 하나의 바이트 상한. 이보다 큰 파일은 혼자 한 단위가 된다.
+const uint64_t RAW_UNIT_BYTES = 64ULL << 20;
+
+struct RawSendContext {
+    std::string source_host;
+    int data_port = 0;
+    std::string target_host;
+    int target_ctrl_port = 0;
+    std::string target_save;
+    bool progress = false;
+    uint64_t rate_limit = 0;
+    RateLimits limits;
+    bool batch = true;
+    int batch_size = 1000;
+    int connections = 4;
+    int parallel = 4;
+    bool bundle = false;
+    uint64_t bundle_threshold = 64 * 1024;
+    uint64_t bundle_bytes = 16ULL << 20;
+    bool sync = false;
+    bool sync_hash = false;
+    bool hardlinks = true;
+    bool dedupe = false;
+    bool local = false; // 대상이 같은 머신 → /api/copy-local-batch
+    bool uds = false;   // 대상이 같은 머신 → 데이터 서버를 unix socket 으로
+};
+
+json raw_file_entry(const RawFile &f, const RawSendContext &ctx) {
+    fs::path rel_parent = f.relative.parent_path();
+    fs::path dest_dir = ctx.target_save.empty() ? rel_parent
+                                                : fs::path(ctx.target_save) / rel_parent;
+    json fj;
+    fj["file"] = f.path.string();
+    fj["relative"] = f.relative.string();
+    fj["saveDir"] = dest_dir.string();
+    return fj;
+}
+
+// 파일 하나를 자기 데이터 서버 + /api/download-file 로 전송 (기존 방식)
+json raw_send_one(const RawFile &f, const RawSendContext &ctx) {
+    json fj = raw_file_entry(f, ctx);
+    std::string dest_dir_str = fj["saveDir"];
+
+    std::cout << "[CONTROL:SEND] RAW 파일 전송: "
+              << f.path << " -> " << dest_dir_str << "\n";
+
+    try {
+        ArchiveInfo ai = prepare_archive(f.path, PackMode::NONE, false);
+        auto size = fs::file_size(ai.archive_path);
+
+        DataServer data;
+        if (!serve_file_download(data.svr(), ai, size, ctx.limits)) {
+            fj["ok"] = false;
+            fj["error"] = "cannot open file";
+            return fj;
+        }
+        if (!data.start("0.0.0.0", ctx.data_port, ctx.uds)) {
+            fj["ok"] = false;
+            fj["error"] = "no free data port";
+            return fj;
+        }
+
+        auto cli2 = ctrl_client(ctx.target_host, ctx.target_ctrl_port);
+        cli2.set_read_timeout(300, 0);
+        std::string url = data.url(ctx.source_host, "/download");
+        fj["dataPort"] = data.port();
+        fj["bindMs"] = data.bind_ms();
+
+        json body2;
+        body2["url"] = url;
+        body2["fileName"] = ai.archive_name;
+        body2["saveDir"] = dest_dir_str;
+        body2["progress"] = ctx.progress;
+        body2["autoExtract"] = false;
+        body2["mode"] = f.mode;
+        body2["mtimeNs"] = f.mtime_ns;
+        if (ctx.rate_limit) body2["rateLimit"] = ctx.rate_limit;
+
+        auto res2 = cli2.Post("/api/download-file", body2.dump(), "application/json");
+        data.stop();
+
+        if (!res2 || res2->status != 200) {
+            fj["ok"] = false;
+            fj["error"] = res2 ? std::to_string(res2->status) : "no response";
+        } else {
+            fj["ok"] = true;
+            try { fj["detail"] = json::parse(res2->body); }
+            catch (...) { fj["detail_raw"] = res2->body; }
+        }
+    } catch (const std::exception &e) {
+        fj["ok"] = false;
+        fj["error"] = std::string("exception: ") + e.what();
+    } catch (...) {
+        fj["ok"] = false;
+        fj["error"] = "unknown exception";
+    }
+    return fj;
+}
+
+// files[ids...] 를 /api/download-batch 한 번으로 전송. 결과는 out[id] 에 채운다.
+// 목록은 바이너리 manifest (id + mode/mtime 포함) 로 보내고, 옵션은 query 로 붙인다.
+// manifest 를 모르는 대상에는 JSON 목록으로 한 번 더 보낸다: 415 (manifest 를 못 읽음) 또는
+// manifest 이전 버전이 본문을 JSON 으로 읽다 낸 400 (parse_error). 다른 400 은 그대로 실패.
+// 대상이 배치 API 를 지원하지 않으면 false (out 은 건드리지 않음).
+bool raw_send_batch(const std::vector<RawFile> &files, const std::size_t *ids, std::size_t count,
+                    const std::string &base_url, const RawSendContext &ctx,
+                    std::vector<json> &out) {
+    ManifestWriter mw(MANIFEST_HAS_IDS);
+    ManifestEntry e;
+    for (std::size_t k = 0; k < count; ++k) {
+        const RawFile &f = files[ids[k]];
+        e.id = ids[k];
+        e.path = f.relative.generic_string();
+        e.size = f.size;
+        e.mtime_ns = f.mtime_ns;
+        e.mode = f.mode;
+        mw.add(e);
+    }
+    httplib::Params params{{"url", base_url},
+                           {"saveDir", ctx.target_save},
+                           {"connections", std::to_string(ctx.connections)}};
+    if (ctx.rate_limit) params.emplace("rateLimit", std::to_string(ctx.rate_limit));
+
+    auto cli = ctrl_client(ctx.target_host, ctx.target_ctrl_port);
+    cli.set_read_timeout(300, 0);
+    auto res2 = cli.Post(httplib::append_query_params("/api/download-batch", params),
+                         mw.finish(), "application/x-p2p-manifest");
+    if (res2 && res2->status == 404) return false;
+    if (res2 && (res2->status == 415 ||
+                 (res2->status == 400 && res2->body.find("parse_error") != std::string::npos))) {
+        json list = json::array();
+        for (std::size_t k = 0; k < count; ++k) {
+            const RawFile &f = files[ids[k]];
+            list.push_back({{"id", ids[k]}, {"path", f.relative.generic_string()},
+                            {"mode", f.mode}, {"mtimeNs", f.mtime_ns}});
+        }
+        json body;
+        body["url"] = base_url;
+        body["saveDir"] = ctx.target_save;
+        body["connections"] = ctx.connections;
+        body["files"] = std::move(list);
+        if (ctx.rate_limit) body["rateLimit"] = ctx.rate_limit;
+        res2 = cli.Post("/api/download-batch", body.dump(), "application/json");
+    }
+
+    json detail;
+    bool parsed = false;
+    if (res2 && res2->status == 200) {
+        try { detail = json::parse(res2->body); parsed = true; }
+        catch (...) {}
+    }
+    std::map<uint64_t, const json *> by_id;
+    if (parsed && detail.contains("results")) {
+        for (auto &r : detail["results"]) by_id[r.value("id", (uint64_t)0)] = &r;
+    }
+    for (std::size_t k = 0; k < count; ++k) {
+        std::size_t i = ids[k];
+        json fj = raw_file_entry(files[i], ctx);
+        auto it = by_id.find(i);
+        if (it == by_id.end()) {
+            fj["ok"] = false;
+            fj["error"] = res2 ? "batch failed: " + std::to_string(res2->status) : "no response";
+        } else if (it->second->value("ok", false)) {
+            fj["ok"] = true;
+            fj["detail"] = {{"status", "ok"}, {"saved", it->second->value("saved", "")}};
+        } else {
+            fj["ok"] = false;
+            fj["error"] = it->second->value("error", "download failed");
+        }
+        out[i] = std::move(fj);
+    }
+    return true;
+}
+
+// bundle 단위 하나(files[ids...])를 /api/download-bundle 한 번으로 전송.
+// 대상이 묶음 API 를 지원하지 않으면 false (out 은 건드리지 않음).
+bool raw_send_bundle(const std::vector<RawFile> &files, const std::size_t *ids, std::size_t count,
+                     const std::string &bundle_url, const RawSendContext &ctx,
+                     std::vector<json> &out) {
+    json body;
+    body["url"] = bundle_url;
+    body["saveDir"] = ctx.target_save;
+    if (ctx.rate_limit) body["rateLimit"] = ctx.rate_limit;
+
+    auto cli = ctrl_client(ctx.target_host, ctx.target_ctrl_port);
+    cli.set_read_timeout(300, 0);
+    auto res2 = cli.Post("/api/download-bundle", body.dump(), "application/json");
+    if (res2 && res2->status == 404) return false;
+
+    json detail;
+    if (res2 && res2->status == 200) {
+        try { detail = json::parse(res2->body); }
+        catch (...) {}
+    }
+    // 결과는 묶음 안의 순서 그대로 온다. path 로 한 번 더 맞춰 본다.
+    const json empty = json::array();
+    const json &results = detail.contains("results") ? detail["results"] : empty;
+    for (std::size_t k = 0; k < count; ++k) {
+        std::size_t i = ids[k];
+        json fj = raw_file_entry(files[i], ctx);
+        fj["bundle"] = true;
+        if (k < results.size() &&
+            results[k].value("path", "") == files[i].relative.generic_string() &&
+            results[k].value("ok", false)) {
+            fj["ok"] = true;
+            fj["detail"] = {{"status", "ok"}, {"saved", results[k].value("saved", "")}};
+        } else {
+            fj["ok"] = false;
+            fj["error"] = k < results.size() ? results[k].value("error", "bundle failed")
+                        : detail.value("error", res2 ? "bundle failed: " + std::to_string(res2->status)
+                                                     : std::string("no response"));
+        }
+        out[i] = std::move(fj);
+    }
+    return true;
+}
+
+// root 아래 일반 파일을 window 개씩 끊어서 꺼내는 walker (최상위 폴더명 prepend).
+// 트리 전체를 메모리에 올리지 않고 디렉토리 순회 상태만 들고 있는다.
+// hardlinks 면 link 수가 2 이상인 파일의 (dev, inode) 를, dedupe 면 크기별 첫 파일들을 기억해
+// 앞서 나온 파일의 사본이면 link_to 를 채운다. 해시는 같은 크기의 파일이 두 번째로 나올 때만 계산한다.
+// 기억하는 항목은 각각 max_tracked 개까지이고, 넘치면 먼저 본 것부터 잊는다 (그 뒤의 사본은 본문으로 감).
+// SUMMARY/STREAM 이 파일 수와 무관한 메모리로 돌도록 raw_send_directory 가 RAW_TRACK_MAX 로 제한한다.
+const std::size_t RAW_TRACK_MAX = 65536;
+
+class RawWalker {
+public:
+    explicit RawWalker(const fs::path &root, bool hardlinks = false, bool dedupe = false,
+                       std::size_t max_tracked = (std::size_t)-1)
+        : root_(root), top_(root.filename()),
+          it_(root, fs::directory_options::skip_permission_denied, ec_),
+          hardlinks_(hardlinks), dedupe_(dedupe), max_tracked_(std::max<std::size_t>(1, max_tracked)) {}
+
+    // 대상 쪽 최상위 이름 (root 의 마지막 이름. "dir/" 이면 비어 있어 내용이 target_save 바로 아래로 감)
+    const fs::path &top() const { return top_; }
+
+    // 최대 max 개. 더 없으면 빈 벡터.
+    std::vector<RawFile> next(std::size_t max) {
+        std::vector<RawFile> files;
+        fs::recursive_directory_iterator end;
+        while (!ec_ && it_ != end && files.size() < max) {
+            const fs::directory_entry &entry = *it_;
+            std::error_code ec;
+            if (entry.is_regular_file(ec)) {
+                fs::path rel = entry.path().lexically_relative(root_);
+                if (rel.empty()) rel = entry.path().filename();
+                RawFile f;
+                f.path = entry.path();
+                f.relative = top_ / rel;
+                struct stat st;
+                if (::stat(entry.path().c_str(), &st) == 0) {
+                    f.size = (uint64_t)st.st_size;
+                    f.mtime_ns = stat_mtime_ns(st);
+                    f.mode = (uint32_t)(st.st_mode & 07777);
+                    f.dev = (uint64_t)st.st_dev;
+                    f.ino = (uint64_t)st.st_ino;
+                    if (hardlinks_ && st.st_nlink > 1) {
+                        auto key = std::make_pair((uint64_t)st.st_dev, (uint64_t)st.st_ino);
+                        auto ins = inodes_.emplace(key, f.relative);
+                        if (!ins.second) {
+                            f.link_to = ins.first->second;
+                            f.hard_link = true;
+                        } else {
+                            inode_order_.push_back(key);
+                            if (inode_order_.size() > max_tracked_) {
+                                inodes_.erase(inode_order_.front());
+                                inode_order_.pop_front();
+                            }
+                        }
+                    }
+                    if (dedupe_ && f.link_to.empty() && f.size > 0) find_duplicate(f);
+                }
+                files.push_back(std::move(f));
+            }
+            it_.increment(ec_);
+        }
+        return files;
+    }
+
+private:
+    struct Seen {
+        fs::path path;
+        fs::path relative;
+        bool hashed;
+        Sha256::Digest hash;
+    };
+
+    void find_duplicate(RawFile &f) {
+        auto &same = by_size_[f.size];
+        if (same.empty()) {
+            same.push_back({f.path, f.relative, false, {}});
+            remember(f.size);
+            return;
+        }
+        Seen cur{f.path, f.relative, true, {}};
+        if (!sha256_file(f.path, cur.hash)) return;
+        for (auto &s : same) {
+            if (!s.hashed) s.hashed = sha256_file(s.path, s.hash);
+            if (s.hashed && s.hash == cur.hash) {
+                f.link_to = s.relative;
+                return;
+            }
+        }
+        same.push_back(std::move(cur));
+        remember(f.size);
+    }
+
+    // by_size_ 에 넣은 순서. 넘치면 가장 먼저 넣은 항목(그 크기 목록의 맨 앞)을 지운다.
+    void remember(uint64_t size) {
+        seen_order_.push_back(size);
+        if (seen_order_.size() <= max_tracked_) return;
+        auto it = by_size_.find(seen_order_.front());
+        seen_order_.pop_front();
+        if (it == by_size_.end()) return;
+        it->second.erase(it->second.begin());
+        if (it->second.empty()) by_size_.erase(it);
+    }
+
+    fs::path root_;
+    fs::path top_;
+    std::error_code ec_;
+    fs::recursive_directory_iterator it_;
+    bool hardlinks_;
+    bool dedupe_;
+    std::size_t max_tracked_;
+    std::map<std::pair<uint64_t, uint64_t>, fs::path> inodes_;
+    std::deque<std::pair<uint64_t, uint64_t>> inode_order_;
+    std::map<uint64_t, std::vector<Seen>> by_size_;
+    std::deque<uint64_t> seen_order_;
+};
+
+// RAW 결과 모으기.
+//  - FULL   : 파일별 결과를 전부 files 배열에 (기존 형식)
+//  - SUMMARY: 개수/바이트 합계 + 실패 항목만 (최대 MAX_FAILURES 개)
+//  - STREAM : 파일별 결과를 NDJSON 한 줄씩 emit 으로 바로 흘려 보냄
+// SUMMARY/STREAM 은 window 단위로 처리하므로 파일 수와 무관하게 메모리가 일정하다.
+struct RawResults {
+    enum Mode { FULL, SUMMARY, STREAM };
+    static const std::size_t MAX_FAILURES = 1000;
+
+    Mode mode = FULL;
+    uint64_t total = 0;
+    uint64_t ok = 0;
+    uint64_t failed = 0;
+    uint64_t bytes = 0;
+    json files = json::array();
+    json failures = json::array();
+    std::function<bool(const std::string &)> emit;
+    bool aborted = false; // STREAM: 받는 쪽이 끊겨 emit 이 실패함 → raw_send_directory 가 멈춘다
+
+    void add(json &&fj, uint64_t size) {
+        total++;
+        bool good = fj.value("ok", false);
+        if (good) {
+            ok++;
+            bytes += size;
+        } else {
+            failed++;
+        }
+        if (mode == FULL) {
+            files.push_back(std::move(fj));
+        } else if (mode == SUMMARY) {
+            if (!good && failures.size() < MAX_FAILURES) failures.push_back(std::move(fj));
+        } else if (emit && !aborted) {
+            fj["type"] = "file";
+            if (!emit(fj.dump() + "\n")) aborted = true;
+        }
+    }
+
+    json summary() const {
+        json j;
+        j["total"] = total;
+        j["ok"] = ok;
+        j["failed"] = failed;
+        j["bytes"] = bytes;
+        return j;
+    }
+};
+
+// 작업 단위: order[begin, end). bundle >= 0 이면 /bundle/<bundle> 로 보내는 묶음 단위.
+struct RawUnit {
+    std::size_t begin;
+    std::size_t end;
+    int bundle;
+};
+
+// order[begin, end) 를 max_count 개, max_bytes 이하 단위로 자른다 (단, 최소 1개).
+void raw_plan_units(const std::vector<RawFile> &files, const std::vector<std::size_t> &order,
+                    std::size_t begin, std::size_t end, std::size_t max_count,
+                    uint64_t max_bytes, bool bundle, std::vector<RawUnit> &units) {
+    while (begin < end) {
+        std::size_t stop = begin;
+        uint64_t bytes = 0;
+        while (stop < end && stop - begin < max_count) {
+            uint64_t sz = files[order[stop]].size;
+            if (stop > begin && bytes + sz > max_bytes) break;
+            bytes += sz;
+            ++stop;
+        }
+        units.push_back({begin, stop, bundle ? (int)units.size() : -1});
+        begin = stop;
+    }
+}
+
+// window 하나(files)를 전송. 결과는 out[i] (files 와 같은 순서).
+void raw_send_window(const std::vector<RawFile> &files, const RawSendContext &ctx,
+                     std::vector<json> &out) {
+    out.assign(files.size(), json());
+
+    // order = [큰 파일(크기 내림차순) ..., 묶음 대상 작은 파일(수집 순서) ...]
+    std::vector<std::size_t> order;
+    std::vector<std::size_t> small;
+    order.reserve(files.size());
+    for (std::size_t i = 0; i < files.size(); ++i) {
+        if (ctx.bundle && files[i].size <= ctx.bundle_threshold) small.push_back(i);
+        else order.push_back(i);
+    }
+    std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+        return files[a].size > files[b].size;
+    });
+    std::size_t n_large = order.size();
+    order.insert(order.end(), small.begin(), small.end());
+    small.clear();
+    small.shrink_to_fit();
+
+    bool use_server = (ctx.batch || ctx.bundle) && !files.empty();
+    std::atomic<bool> batch_ok{ctx.batch && use_server};
+    std::atomic<bool> bundle_ok{ctx.bundle && use_server};
+
+    std::vector<RawUnit> units;
+    raw_plan_units(files, order, 0, n_large,
+                   ctx.batch ? (std::size_t)std::max(1, ctx.batch_size) : 1,
+                   RAW_UNIT_BYTES, false, units);
+    std::vector<RawUnit> bundle_units;
+    if (ctx.bundle) {
+        raw_plan_units(files, order, n_large, order.size(), (std::size_t)-1,
+                       std::max<uint64_t>(1, ctx.bundle_bytes), true, bundle_units);
+        units.insert(units.end(), bundle_units.begin(), bundle_units.end());
+    }
+
+    DataServer data;
+    std::string base;
+    if (use_server) {
+        auto paths = std::make_shared<std::vector<fs::path>>();
+        paths->reserve(files.size());
+        for (auto &f : files) paths->push_back(f.path);
+        serve_file_list(data.svr(), paths, ctx.limits);
+        if (!bundle_units.empty()) {
+            auto bundles = std::make_shared<std::vector<std::vector<BundleEntry>>>();
+            for (auto &u : bundle_units) {
+                std::vector<BundleEntry> entries;
+                for (std::size_t k = u.begin; k < u.end; ++k) {
+                    const RawFile &f = files[order[k]];
+                    entries.push_back(make_bundle_entry(f.path, f.relative.generic_string()));
+                }
+                bundles->push_back(std::move(entries));
+            }
+            serve_bundles(data.svr(), bundles, ctx.limits);
+        }
+        // 워커마다 대상이 connections 개씩 keep-alive 로 붙으므로 그만큼 처리 스레드를 둔다
+        std::size_t nthreads = (std::size_t)std::max(1, ctx.parallel) * std::max(1, ctx.connections) + 2;
+        data.svr().new_task_queue = [nthreads] { return new httplib::ThreadPool(nthreads); };
+        if (data.start("0.0.0.0", ctx.data_port, ctx.uds)) {
+            base = data.url(ctx.source_host, "");
+        } else {
+            batch_ok = false;
+            bundle_ok = false;
+        }
+    }
+
+    int workers = std::max(1, std::min(ctx.parallel, (int)units.size()));
+    std::cout << "[CONTROL:SEND] RAW 전송: " << files.size() << " files, "
+              << units.size() << " units (bundles " << bundle_units.size() << "), workers " << workers
+              << (batch_ok ? ", batch " + base : std::string(", per-file")) << "\n";
+
+    std::atomic<std::size_t> next_unit{0};
+    auto worker = [&]() {
+        for (std::size_t u; (u = next_unit.fetch_add(1)) < units.size(); ) {
+            const std::size_t *ids = order.data() + units[u].begin;
+            std::size_t count = units[u].end - units[u].begin;
+            if (units[u].bundle >= 0 && bundle_ok) {
+                std::string url = base + "/bundle/" + std::to_string(units[u].bundle);
+                if (raw_send_bundle(files, ids, count, url, ctx, out)) continue;
+                if (bundle_ok.exchange(false)) {
+                    std::cout << "[CONTROL:SEND] 대상이 묶음 API 미지원 → 배치 전송\n";
+                }
+            }
+            if (batch_ok && raw_send_batch(files, ids, count, base, ctx, out)) continue;
+            if (batch_ok.exchange(false)) {
+                std::cout << "[CONTROL:SEND] 대상이 배치 API 미지원 → 파일별 전송\n";
+            }
+            for (std::size_t k = 0; k < count; ++k) out[ids[k]] = raw_send_one(files[ids[k]], ctx);
+        }
+    };
+    std::vector<std::thread> ths;
+    for (int w = 1; w < workers; ++w) ths.emplace_back(worker);
+    worker();
+    for (auto &t : ths) t.join();
+    data.stop();
+}
+
+// 같은 머신의 대상에게 window 를 /api/copy-local-batch 로 batch_size 개씩 복사시킨다.
+// parallel 개의 요청을 동시에 보낸다. 첫 요청이 404(구버전) / 409(실제로는 다른 머신)면
+// false 를 돌려 네트워크 전송으로 되돌아가게 한다. 뒤쪽 chunk 가 409 면 (그 사이 원본이 바뀜 등)
+// 그 chunk 만 네트워크로 보낸다.
+bool raw_copy_window(const std::vector<RawFile> &files, const RawSendContext &ctx,
+                     std::vector<json> &out) {
+    out.assign(files.size(), json());
+    std::size_t step = (std::size_t)std::max(1, ctx.batch_size);
+    std::size_t nchunks = (files.size() + step - 1) / step;
+
+    // chunk 하나를 보낸다. 대상이 로컬 복사를 거절하면 false.
+    auto send_chunk = [&](std::size_t c) {
+        std::size_t begin = c * step;
+        std::size_t end = std::min(files.size(), begin + step);
+        json list = json::array();
+        for (std::size_t i = begin; i < end; ++i) {
+            json e = local_file_id(files[i].dev, files[i].ino, files[i].size, files[i].mtime_ns);
+            e["src"] = fs::absolute(files[i].path).string();
+            e["path"] = files[i].relative.generic_string();
+            list.push_back(std::move(e));
+        }
+        json body;
+        body["saveDir"] = ctx.target_save;
+        body["files"] = std::move(list);
+        if (ctx.rate_limit) body["rateLimit"] = ctx.rate_limit;
+        auto cli = ctrl_client(ctx.target_host, ctx.target_ctrl_port);
+        cli.set_read_timeout(300, 0);
+        auto res2 = cli.Post("/api/copy-local-batch", body.dump(), "application/json");
+        if (res2 && (res2->status == 404 || res2->status == 409)) return false;
+
+        json detail;
+        if (res2 && res2->status == 200) {
+            try { detail = json::parse(res2->body); }
+            catch (...) {}
+        }
+        const json empty = json::array();
+        const json &results = detail.contains("results") ? detail["results"] : empty;
+        for (std::size_t i = begin; i < end; ++i) {
+            json fj = raw_file_entry(files[i], ctx);
+            fj["local"] = true;
+            std::size_t k = i - begin;
+            if (k < results.size() && results[k].value("ok", false)) {
+                fj["ok"] = true;
+                fj["detail"] = {{"status", "ok"}, {"saved", results[k].value("saved", "")},
+                                {"method", results[k].value("method", "")}};
+            } else {
+                fj["ok"] = false;
+                fj["error"] = k < results.size() ? results[k].value("error", "copy failed")
+                            : res2 ? "copy failed: " + std::to_string(res2->status)
+                                   : std::string("no response");
+            }
+            out[i] = std::move(fj);
+        }
+        return true;
+    };
+
+    if (nchunks == 0) return true;
+    if (!send_chunk(0)) return false;
+    std::cout << "[CONTROL:SEND] RAW 로컬 복사: " << files.size() << " files\n";
+    std::atomic<std::size_t> next{1};
+    std::mutex rejected_mu;
+    std::vector<std::size_t> rejected;
+    auto worker = [&]() {
+        for (std::size_t c; (c = next.fetch_add(1)) < nchunks; ) {
+            if (send_chunk(c)) continue;
+            std::lock_guard<std::mutex> lk(rejected_mu);
+            rejected.push_back(c);
+        }
+    };
+    int workers = std::max(1, std::min(ctx.parallel, (int)nchunks - 1));
+    std::vector<std::thread> ths;
+    for (int w = 1; w < workers; ++w) ths.emplace_back(worker);
+    worker();
+    for (auto &t : ths) t.join();
+
+    if (!rejected.empty()) {
+        std::vector<std::size_t> idx;
+        std::vector<RawFile> retry;
+        for (std::size_t c : rejected) {
+            for (std::size_t i = c * step; i < std::min(files.size(), (c + 1) * step); ++i) {
+                idx.push_back(i);
+                retry.push_back(files[i]);
+            }
+        }
+        std::cout << "[CONTROL:SEND] 로컬 복사 거절 " << retry.size() << " files → 네트워크 전송\n";
+        std::vector<json> sent;
+        raw_send_window(retry, ctx, sent);
+        for (std::size_t k = 0; k < idx.size(); ++k) out[idx[k]] = std::move(sent[k]);
+    }
+    return true;
+}
+
+// 사본(link_to) 파일들을 /api/link-files 로 대상에서 만든다. 결과는 out[i] (files 와 같은 순서).
+// 대상이 API 를 모르면 false (out 은 건드리지 않음).
+bool raw_send_links(const std::vector<RawFile> &files, const RawSendContext &ctx,
+                    std::vector<json> &out) {
+    out.assign(files.size(), json());
+    auto cli = ctrl_client(ctx.target_host, ctx.target_ctrl_port);
+    cli.set_read_timeout(300, 0);
+    std::size_t step = (std::size_t)std::max(1, ctx.batch_size);
+    for (std::size_t begin = 0; begin < files.size(); begin += step) {
+        std::size_t end = std::min(files.size(), begin + step);
+        json links = json::array();
+        for (std::size_t i = begin; i < end; ++i) {
+            const RawFile &f = files[i];
+            links.push_back({{"path", f.relative.generic_string()},
+                             {"target", f.link_to.generic_string()},
+                             {"hard", f.hard_link},
+                             {"mode", f.mode},
+                             {"mtimeNs", f.mtime_ns}});
+        }
+        json body;
+        body["saveDir"] = ctx.target_save;
+        body["links"] = std::move(links);
+        auto res2 = cli.Post("/api/link-files", body.dump(), "application/json");
+        if (res2 && res2->status == 404 && begin == 0) return false;
+        json detail;
+        if (res2 && res2->status == 200) {
+            try { detail = json::parse(res2->body); }
+            catch (...) {}
+        }
+        const json empty = json::array();
+        const json &results = detail.contains("results") ? detail["results"] : empty;
+        for (std::size_t i = begin; i < end; ++i) {
+            json fj = raw_file_entry(files[i], ctx);
+            fj["link"] = files[i].hard_link ? "hard" : "copy";
+            fj["linkTarget"] = files[i].link_to.generic_string();
+            std::size_t k = i - begin;
+            if (k < results.size() && results[k].value("ok", false)) {
+                fj["ok"] = true;
+            } else {
+                fj["ok"] = false;
+                fj["error"] = k < results.size() ? results[k].value("error", "link failed")
+                            : res2 ? "link failed: " + std::to_string(res2->status)
+                                   : std::string("no response");
+            }
+            out[i] = std::move(fj);
+        }
+    }
+    return true;
+}
+
+// sync 모드: 대상이 이미 가진 파일 목록 (상대 경로 → 크기, mtime 또는 내용 해시).
+// 대상 manifest 는 임시 파일로 받아 mmap 한 채 한 번 훑는다. 건너뛰기는 필드를 그대로 비교해서만
+// 정한다 (지문 충돌로 내용이 다른 파일을 건너뛰면 안 되므로 해시로 줄이지 않는다).
+class RawSyncIndex {
+public:
+    // 대상의 target_save/<top> 목록을 받아 온다. 실패하면 빈 집합 (전부 전송).
+    // top 은 RawWalker::top() 과 같아야 한다 ("dir/" 처럼 비어 있으면 target_save 바로 아래).
+    bool load(const RawSendContext &ctx, const fs::path &top) {
+        fs::path remote = ctx.target_save.empty() ? top : fs::path(ctx.target_save) / top;
+        if (remote.empty()) remote = ".";
+        httplib::Params params{{"path", remote.string()}};
+        if (ctx.sync_hash) params.emplace("hash", "1");
+        fs::path tmp = fs::temp_directory_path() /
+                       ("p2p-manifest-" + std::to_string(::getpid()) + "-" +
+                        std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())));
+        bool ok = http_download_file(ctx.target_host, ctx.target_ctrl_port,
+                                     httplib::append_query_params("/api/manifest", params),
+                                     tmp, false);
+        if (ok) {
+            MappedFile mf(tmp);
+            ManifestReader reader(mf.data(), mf.size());
+            ok = reader.valid();
+            std::string prefix = top.empty() ? std::string() : top.generic_string() + "/";
+            ManifestEntry e;
+            while (reader.next(e)) {
+                Remote &r = have_[prefix + e.path];
+                r.size = e.size;
+                r.mtime_ns = e.mtime_ns;
+                if (ctx.sync_hash) r.hash = e.hash;
+            }
+        }
+        std::error_code ec;
+        fs::remove(tmp, ec);
+        return ok;
+    }
+
+    std::size_t size() const { return have_.size(); }
+
+    // 대상에 같은 파일이 있으면 true. 해시 비교는 경로/크기가 같은 후보만 읽는다.
+    bool has(const RawFile &f, bool by_hash) const {
+        if (have_.empty()) return false;
+        auto it = have_.find(f.relative.generic_string());
+        if (it == have_.end() || it->second.size != f.size) return false;
+        if (!by_hash) return it->second.mtime_ns == f.mtime_ns;
+        Sha256::Digest d;
+        return sha256_file(f.path, d) && d == it->second.hash;
+    }
+
+private:
+    struct Remote {
+        uint64_t size = 0;
+        int64_t mtime_ns = 0;
+        Sha256::Digest hash{};
+    };
+    std::unordered_map<std::string, Remote> have_;
+};
+
+// RAW 디렉토리 전송 전체. FULL 은 트리 전체를 한 window 로(큰 파일 우선 순서가 전역),
+// SUMMARY/STREAM 은 window_files 개씩 끊어 처리하고 결과를 바로 흘려 보낸다.
+void raw_send_directory(const fs::path &root, const RawSendContext &ctx,
+                        std::size_t window_files, RawResults &results) {
+    RawWalker walker(root, ctx.hardlinks, ctx.dedupe,
+                     results.mode == RawResults::FULL ? (std::size_t)-1 : RAW_TRACK_MAX);
+    bool links_ok = true;
+    bool local_ok = ctx.local;
+    std::size_t window = results.mode == RawResults::FULL ? (std::size_t)-1
+                                                          : std::max<std::size_t>(1, window_files);
+    RawSyncIndex have;
+    if (ctx.sync) {
+        bool loaded = have.load(ctx, walker.top());
+        std::cout << "[CONTROL:SEND] sync: 대상 manifest "
+                  << (loaded ? std::to_string(have.size()) + " files" : std::string("없음 → 전체 전송"))
+                  << "\n";
+    }
+    std::vector<json> out;
+    while (!results.aborted) {
+        std::vector<RawFile> files = walker.next(window);
+        if (files.empty()) break;
+        if (have.size()) {
+            std::vector<RawFile> todo;
+            for (auto &f : files) {
+                if (!have.has(f, ctx.sync_hash)) {
+                    todo.push_back(std::move(f));
+                    continue;
+                }
+                json fj = raw_file_entry(f, ctx);
+                fj["ok"] = true;
+                fj["skipped"] = true;
+                results.add(std::move(fj), 0);
+            }
+            files.swap(todo);
+            if (files.empty()) continue;
+        }
+        // 사본은 원본이 대상에 생긴 뒤(이 window 전송 후) 만든다
+        std::vector<RawFile> links;
+        if (ctx.hardlinks || ctx.dedupe) {
+            auto mid = std::stable_partition(files.begin(), files.end(),
+                                             [](const RawFile &f) { return f.link_to.empty(); });
+            links.assign(std::make_move_iterator(mid), std::make_move_iterator(files.end()));
+            files.erase(mid, files.end());
+        }
+        if (!files.empty()) {
+            if (!local_ok || !raw_copy_window(files, ctx, out)) {
+                if (local_ok) {
+                    local_ok = false;
+                    std::cout << "[CONTROL:SEND] 대상이 로컬 복사 불가 → 네트워크 전송\n";
+                }
+                raw_send_window(files, ctx, out);
+            }
+            for (std::size_t i = 0; i < files.size(); ++i) results.add(std::move(out[i]), files[i].size);
+        }
+        if (links.empty() || results.aborted) continue;
+        if (links_ok && raw_send_links(links, ctx, out)) {
+            for (std::size_t i = 0; i < links.size(); ++i) results.add(std::move(out[i]), 0);
+            continue;
+        }
+        if (links_ok) {
+            links_ok = false;
+            std::cout << "[CONTROL:SEND] 대상이 link API 미지원 → 사본도 본문 전송\n";
+        }
+        raw_send_window(links, ctx, out);
+        for (std::size_t i = 0; i < links.size(); ++i) results.add(std::move(out[i]), links[i].size);
+    }
+}
+
+// ---------------- node info (master) ----------------
+// 노드 하나. host/port/name 은 만든 뒤 바뀌지 않고 (이름이 바뀌면 새 NodeInfo 로 교체),
+// heartbeat 가 바꾸는 last_seen 만 atomic 이라 스냅샷을 잡은 쪽이 락 없이 읽는다.
+struct NodeInfo {
+    std::string host;
+    int ctrl_port = 0;
+    std::string name;
+    std::string zone;  // 위치 라벨 "dc/rack" (--zone). 없으면 "" (send-all topology 참고)
+    bool self = false; // 마스터 자신 (heartbeat 없이 항상 살아 있음)
+    std::atomic<uint64_t> last_seen{0};
+    std::atomic<bool> verified{true}; // false = 재시작 전 스냅샷에서 읽어 와 아직 소식을 못 받음
+
+    std::string key() const { return host + ":" + std::to_string(ctrl_port); }
+
+    // 마지막 heartbeat 의 자원 상태 (worker_resources 참고). 없으면 nullptr.
+    std::shared_ptr<const json> resources() const { return std::atomic_load(&resources_); }
+    void set_resources(std::shared_ptr<const json> r) { std::atomic_store(&resources_, std::move(r)); }
+
+private:
+    std::shared_ptr<const json> resources_;
+};
+
+using NodePtr = std::shared_ptr<NodeInfo>;
+using NodeList = std::vector<NodePtr>;
+
+// 마스터의 노드 목록. host:port 해시로 나눈 shard 마다 락이 따로 있어 register/heartbeat 는
+// 해당 shard 만 잡고 O(1) 로 끝난다. 목록/send-all 은 snapshot() 으로 불변 목록을 받아 락 없이 돈다.
+// 스냅샷은 구성이 바뀔 때(등록/이름 변경/제거)만 다시 만들고, 그것도 바뀐 뒤 처음 읽는 쪽이
+// 한 번 만든다 (수천 노드가 한꺼번에 등록해도 등록마다 목록 전체를 복사하지 않도록).
+// 구성/생존 상태가 바뀔 때마다 version 이 1 씩 오르고 바뀐 key 가 변경 로그에 남아,
+// /api/nodes?since=<version> 이 바뀐 노드만 돌려줄 수 있다. (heartbeat 의 lastSeen 갱신은 변경이 아님)
+class NodeRegistry {
+public:
+    static const std::size_t SHARDS = 64;
+    static const std::size_t CHANGE_LOG_MAX = 100000;
+
+    NodeRegistry() : snap_(std::make_shared<const NodeList>()) {}
+
+    // 등록 (이미 있으면 last_seen 갱신, 이름/zone 이 다르면 교체). 새 노드면 true.
+    bool upsert(const std::string &host, int ctrl_port, const std::string &name,
+                uint64_t now, bool self = false, const std::string &zone = "") {
+        auto n = std::make_shared<NodeInfo>();
+        n->host = host;
+        n->ctrl_port = ctrl_port;
+        n->name = name;
+        n->zone = zone;
+        n->self = self;
+        n->last_seen = now;
+        std::string key = n->key();
+        Shard &sh = shard(key);
+        std::lock_guard<std::mutex> lk(sh.mu);
+        auto it = sh.map.find(key);
+        if (it != sh.map.end() && (name.empty() || (it->second->name == name && it->second->zone == zone))) {
+            it->second->last_seen = now;
+            if (!it->second->verified.exchange(true)) log_change(key);
+            return false;
+        }
+        if (it != sh.map.end()) n->self = n->self || it->second->self;
+        bool added = it == sh.map.end();
+        sh.map[key] = std::move(n);
+        changed(key);
+        return added;
+    }
+
+    // heartbeat: 있으면 last_seen 갱신 후 이전 값을 돌려준다. 모르는 노드면 false.
+    // resources 가 있으면 함께 바꾼다 (version 은 그대로).
+    bool touch(const std::string &host, int ctrl_port, uint64_t now, uint64_t *prev = nullptr,
+               std::shared_ptr<const json> resources = nullptr) {
+        std::string key = host + ":" + std::to_string(ctrl_port);
+        Shard &sh = shard(key);
+        std::lock_guard<std::mutex> lk(sh.mu);
+        auto it = sh.map.find(key);
+        if (it == sh.map.end()) return false;
+        uint64_t old = it->second->last_seen.exchange(now);
+        if (resources) it->second->set_resources(std::move(resources));
+        if (!it->second->verified.exchange(true)) log_change(key);
+        if (prev) *prev = old;
+        return true;
+    }
+
+    // 스냅샷에서 읽은 노드: 없을 때만 verified=false, last_seen=seen 으로 넣는다
+    void restore(const std::string &host, int ctrl_port, const std::string &name,
+                 const std::string &zone, uint64_t seen) {
+        auto n = std::make_shared<NodeInfo>();
+        n->host = host;
+        n->ctrl_port = ctrl_port;
+        n->name = name;
+        n->zone = zone;
+        n->last_seen = seen;
+        n->verified = false;
+        std::string key = n->key();
+        Shard &sh = shard(key);
+        std::lock_guard<std::mutex> lk(sh.mu);
+        if (sh.map.count(key)) return;
+        sh.map[key] = std::move(n);
+        changed(key);
+    }
+
+    bool remove(const std::string &key) {
+        Shard &sh = shard(key);
+        std::lock_guard<std::mutex> lk(sh.mu);
+        if (!sh.map.erase(key)) return false;
+        changed(key);
+        return true;
+    }
+
+    // 지금 key 에 있는 노드의 last_seen 이 cutoff 보다 앞설 때만 지운다 (self 는 지우지 않음).
+    // 스냅샷을 본 뒤 heartbeat/재등록(새 NodeInfo 로 교체 포함)이 왔으면 그대로 둔다.
+    bool remove_if_stale(const std::string &key, uint64_t cutoff) {
+        Shard &sh = shard(key);
+        std::lock_guard<std::mutex> lk(sh.mu);
+        auto it = sh.map.find(key);
+        if (it == sh.map.end() || it->second->self || it->second->last_seen.load() >= cutoff) return false;
+        sh.map.erase(it);
+        changed(key);
+        return true;
+    }
+
+    // 생존 상태가 바뀐 노드를 변경으로 기록 (sweeper / heartbeat 복귀)
+    void mark(const std::string &key) { log_change(key); }
+
+    NodePtr find(const std::string &key) {
+        Shard &sh = shard(key);
+        std::lock_guard<std::mutex> lk(sh.mu);
+        auto it = sh.map.find(key);
+        return it == sh.map.end() ? nullptr : it->second;
+    }
+
+    uint64_t version() const { return version_.load(); }
+
+    // since 이후 바뀐 key 들 (중복 없이). since 가 변경 로그보다 오래되면 false → 전체를 다시 받아야 한다.
+    bool changes_since(uint64_t since, std::vector<std::string> &keys, uint64_t &version) {
+        std::lock_guard<std::mutex> lk(log_mu_);
+        version = version_.load();
+        if (since > version) return false;
+        if (since < version && (log_.empty() || log_.front().first > since + 1)) return false;
+        std::unordered_set<std::string> seen;
+        for (auto it = log_.rbegin(); it != log_.rend() && it->first > since; ++it) {
+            if (seen.insert(it->second).second) keys.push_back(it->second);
+        }
+        return true;
+    }
+
+    std::shared_ptr<const NodeList> snapshot() {
+        if (dirty_.load(std::memory_order_acquire)) rebuild();
+        return std::atomic_load(&snap_);
+    }
+
+private:
+    struct Shard {
+        std::mutex mu;
+        std::unordered_map<std::string, NodePtr> map;
+    };
+
+    Shard &shard(const std::string &key) { return shards_[std::hash<std::string>()(key) % SHARDS]; }
+
+    void changed(const std::string &key) {
+        dirty_.store(true, std::memory_order_release);
+        log_change(key);
+    }
+
+    void log_change(const std::string &key) {
+        std::lock_guard<std::mutex> lk(log_mu_);
+        log_.emplace_back(++version_, key);
+        if (log_.size() > CHANGE_LOG_MAX) log_.pop_front();
+    }
+
+    void rebuild() {
+        std::lock_guard<std::mutex> lk(rebuild_mu_);
+        if (!dirty_.exchange(false, std::memory_order_acq_rel)) return; // 다른 스레드가 이미 만듦
+        auto list = std::make_shared<NodeList>();
+        for (auto &sh : shards_) {
+            std::lock_guard<std::mutex> lk2(sh.mu);
+            for (auto &kv : sh.map) list->push_back(kv.second);
+        }
+        // 등록 순서 대신 주소 순으로 (shard 배치와 무관하게 목록 순서가 안정적이도록)
+        std::sort(list->begin(), list->end(), [](const NodePtr &a, const NodePtr &b) {
+            return a->host != b->host ? a->host < b->host : a->ctrl_port < b->ctrl_port;
+        });
+        std::atomic_store(&snap_, std::shared_ptr<const NodeList>(std::move(list)));
+    }
+
+    std::array<Shard, SHARDS> shards_;
+    std::atomic<bool> dirty_{false};
+    std::mutex rebuild_mu_;
+    std::shared_ptr<const NodeList> snap_;
+    std::mutex log_mu_;
+    std::deque<std::pair<uint64_t, std::string>> log_;
+    std::atomic<uint64_t> version_{0};
+};
+
+NodeRegistry g_nodes;
+
+// liveness: 워커는 heartbeat_sec 마다 /api/heartbeat 를 보내고, 마스터는 마지막 소식이
+// g_node_ttl_sec 보다 오래된 노드를 send-all 대상에서 빼며, g_node_evict_sec 이 지나면 목록에서 지운다.
+// (0 = 끔)
+uint64_t g_node_ttl_sec = 30;
+uint64_t g_node_evict_sec = 600;
+
+bool node_alive(const NodeInfo &n, uint64_t now) {
+    return n.self || g_node_ttl_sec == 0 || n.last_seen.load() + g_node_ttl_sec >= now;
+}
+
+json node_json(const NodeInfo &n, uint64_t now) {
+    json j = {{"host", n.host}, {"ctrlPort", n.ctrl_port}, {"name", n.name},
+              {"lastSeen", n.last_seen.load()}, {"alive", node_alive(n, now)}};
+    if (!n.zone.empty()) j["zone"] = n.zone;
+    if (!n.verified) j["verified"] = false;
+    if (auto r = n.resources()) j["resources"] = *r;
+    return j;
+}
+
+// heartbeat 본문의 resources 를 꺼낸다 (없거나 객체가 아니면 nullptr)
+// 다른 노드가 보낸 값이라 아는 필드의 타입을 확인하고, 타입이 틀린 필드는 버린다
+// (send-all 이 value() 로 읽다가 type_error 로 죽지 않도록).
+std::shared_ptr<const json> heartbeat_resources(const json &body) {
+    auto it = body.find("resources");
+    if (it == body.end() || !it->is_object()) return nullptr;
+    json r = *it;
+    for (const char *k : {"load1", "cpus", "active", "queued", "maxActive", "netRxBps", "netTxBps"}) {
+        if (r.contains(k) && !r[k].is_number()) r.erase(k);
+    }
+    if (r.contains("cwd") && !r["cwd"].is_string()) r.erase("cwd");
+    if (r.contains("disk")) {
+        json disks = json::array();
+        if (r["disk"].is_array()) {
+            for (auto &d : r["disk"]) {
+                if (d.is_object() && d.value("path", json()).is_string() && d.value("free", json()).is_number()) {
+                    disks.push_back(d);
+                }
+            }
+        }
+        r["disk"] = std::move(disks);
+    }
+    return std::make_shared<const json>(std::move(r));
+}
+
+// 자원 보고에서 dest 가 들어가는 디스크의 남은 바이트. 상대 경로는 노드의 cwd 기준.
+// 보고된 경로 중 dest 를 가장 길게 덮는 것을 쓰고, 없으면 false.
+// 경로가 덮는다고 같은 파일시스템이라는 보장은 없으니 (cwd 가 / 이고 dest 는 따로 마운트된 곳 등)
+// 이 값은 후보를 고르는 데만 쓰고, 건너뛰기 전에 노드에 직접 물어 확인한다 (/api/file-info free=1).
+bool resources_free_bytes(const json &r, const std::string &dest, uint64_t &free) {
+    fs::path d = dest.empty() ? fs::path(r.value("cwd", "")) : fs::path(dest);
+    if (d.is_relative()) d = fs::path(r.value("cwd", "")) / d;
+    std::string ds = d.lexically_normal().generic_string();
+    std::size_t best = 0;
+    bool found = false;
+    auto disks = r.find("disk");
+    if (disks == r.end() || !disks->is_array()) return false;
+    for (auto &e : *disks) {
+        std::string p = fs::path(e.value("path", "")).lexically_normal().generic_string();
+        while (p.size() > 1 && p.back() == '/') p.pop_back();
+        bool covers = !p.empty() && starts_with(ds, p) &&
+                      (ds.size() == p.size() || ds[p.size()] == '/' || p == "/");
+        if (covers && p.size() >= best) {
+            best = p.size();
+            free = e.value("free", (uint64_t)0);
+            found = true;
+        }
+    }
+    return found;
+}
+
+// 대상 노드에 dest 가 놓일 파일시스템의 남은 바이트를 직접 묻는다. 응답이 없거나 구버전이면 false.
+bool target_free_bytes(const std::string &host, int port, const std::string &dest, uint64_t &free) {
+    auto cli = ctrl_client(host, port);
+    cli.set_read_timeout(5, 0);
+    auto r = cli.Get(httplib::append_query_params("/api/file-info", {{"path", dest}, {"free", "1"}}));
+    if (!r || r->status != 200) return false;
+    try {
+        auto j = json::parse(r->body);
+        if (!j.contains("free") || !j["free"].is_number_unsigned()) return false;
+        free = j["free"].get<uint64_t>();
+        return true;
+    } catch (...) {
+        return false;
+    }
+}
+
+// path 가 놓일 파일시스템의 남은 바이트. 아직 없는 경로면 있는 가장 가까운 상위 디렉토리로 본다.
+bool path_free_bytes(fs::path p, uint64_t &free) {
+    std::error_code ec;
+    p = fs::absolute(p, ec).lexically_normal();
+    if (ec) return false;
+    while (!fs::exists(p, ec)) {
+        if (!p.has_relative_path()) return false;
+        p = p.parent_path();
+    }
+    struct statvfs vs;
+    if (::statvfs(p.c_str(), &vs) != 0) return false;
+    free = (uint64_t)vs.f_bavail * vs.f_frsize;
+    return true;
+}
+
+// ---------------- registry snapshot ----------------
+// --registry-file: 마스터가 노드 목록을 바뀌었을 때마다 (sweeper 주기로) 파일에 쓰고 시작할 때 읽는다.
+// 형식: "P2PN" | ver u8 | count varint | (host, name: varint 길이 + 바이트, ctrlPort, lastSeen: varint,
+//        zone: varint 길이 + 바이트 (ver 2 부터))*
+// 읽어 온 노드는 verified=false 이고 마지막 소식은 저장된 lastSeen 그대로라, 재시작 전에 이미
+// 끊겼던 노드는 stale 로 돌아오고 node-evict 를 넘긴 노드는 아예 읽지 않는다. 마스터가 잠깐
+// 내려갔다 온 경우의 노드는 남은 node-ttl 동안 send-all 에 쓰이고, heartbeat 가 오면 verified 가 된다.
+const char REGISTRY_MAGIC[4] = {'P', '2', 'P', 'N'};
+
+bool save_registry(const fs::path &file) {
+    auto nodes = g_nodes.snapshot();
+    std::string buf(REGISTRY_MAGIC, 4);
+    buf.push_back(2);
+    std::size_t count = 0;
+    std::string body;
+    for (auto &n : *nodes) {
+        if (n->self) continue;
+        put_varint(body, n->host.size());
+        body += n->host;
+        put_varint(body, n->name.size());
+        body += n->name;
+        put_varint(body, (uint64_t)n->ctrl_port);
+        put_varint(body, n->last_seen.load());
+        put_varint(body, n->zone.size());
+        body += n->zone;
+        ++count;
+    }
+    put_varint(buf, count);
+    buf += body;
+    fs::path tmp = file.string() + ".tmp";
+    {
+        std::ofstream ofs(tmp, std::ios::binary | std::ios::trunc);
+        ofs.write(buf.data(), (std::streamsize)buf.size());
+        if (!ofs) return false;
+    }
+    std::error_code ec;
+    fs::rename(tmp, file, ec);
+    return !ec;
+}
+
+std::size_t load_registry(const fs::path &file) {
+    MappedFile mf(file);
+    const uint8_t *p = (const uint8_t *)mf.data();
+    if (!p || mf.size() < 5 || std::memcmp(p, REGISTRY_MAGIC, 4) != 0 || p[4] < 1 || p[4] > 2) return 0;
+    int ver = p[4];
+    const uint8_t *end = p + mf.size();
+    p += 5;
+    uint64_t count = 0;
+    if (!get_varint(p, end, count)) return 0;
+    uint64_t now = (uint64_t)std::time(nullptr);
+    std::size_t loaded = 0;
+    auto get_str = [&](std::string &out) {
+        uint64_t len;
+        if (!get_varint(p, end, len) || len > (uint64_t)(end - p)) return false;
+        out.assign((const char *)p, (std::size_t)len);
+        p += len;
+        return true;
+    };
+    for (uint64_t i = 0; i < count; ++i) {
+        std::string host, name, zone;
+        uint64_t port, seen;
+        if (!get_str(host) || !get_str(name) || !get_varint(p, end, port) || !get_varint(p, end, seen)) break;
+        if (ver >= 2 && !get_str(zone)) break;
+        seen = std::min(seen, now);
+        if (g_node_evict_sec && seen + g_node_evict_sec < now) continue;
+        g_nodes.restore(host, (int)port, name, zone, seen);
+        ++loaded;
+    }
+    return loaded;
+}
+
+// ---------------- link matrix ----------------
+// 노드 쌍 사이 링크 측정 결과 (마스터, /api/measure → /api/matrix).
+// (from, to) 는 데이터가 흐르는 방향: to 가 from 의 데이터 서버에서 받아 잰 값이다.
+struct LinkStat {
+    double bytes_per_sec = 0;
+    double rtt_ms = 0;
+    uint64_t measured_at = 0; // unix 초
+    std::string error;        // 비어 있지 않으면 측정 실패
+};
+
+class LinkMatrix {
+public:
+    void set(const std::string &from, const std::string &to, const LinkStat &l) {
+        std::lock_guard<std::mutex> lk(mu_);
+        links_[{from, to}] = l;
+    }
+
+    bool get(const std::string &from, const std::string &to, LinkStat &out) const {
+        std::lock_guard<std::mutex> lk(mu_);
+        auto it = links_.find({from, to});
+        if (it == links_.end() || !it->second.error.empty()) return false;
+        out = it->second;
+        return true;
+    }
+
+    // 측정 진행 상태
+    bool begin(std::size_t total) {
+        std::lock_guard<std::mutex> lk(mu_);
+        if (running_) return false;
+        running_ = true;
+        done_ = 0;
+        total_ = total;
+        return true;
+    }
+    void step() {
+        std::lock_guard<std::mutex> lk(mu_);
+        ++done_;
+    }
+    void end() {
+        std::lock_guard<std::mutex> lk(mu_);
+        running_ = false;
+    }
+
+    json to_json() const {
+        std::lock_guard<std::mutex> lk(mu_);
+        json j;
+        j["running"] = running_;
+        j["done"] = done_;
+        j["total"] = total_;
+        std::set<std::string> nodes;
+        json arr = json::array();
+        for (auto &kv : links_) {
+            nodes.insert(kv.first.first);
+            nodes.insert(kv.first.second);
+            json l = {{"from", kv.first.first}, {"to", kv.first.second}, {"at", kv.second.measured_at}};
+            if (kv.second.error.empty()) {
+                l["bytesPerSec"] = (uint64_t)kv.second.bytes_per_sec;
+                l["rttMs"] = kv.second.rtt_ms;
+            } else {
+                l["error"] = kv.second.error;
+            }
+            arr.push_back(std::move(l));
+        }
+        j["nodes"] = nodes;
+        j["links"] = std::move(arr);
+        return j;
+    }
+
+private:
+    mutable std::mutex mu_;
+    std::map<std::pair<std::string, std::string>, LinkStat> links_;
+    bool running_ = false;
+    std::size_t done_ = 0, total_ = 0;
+};
+
+LinkMatrix g_links;
+
+// 모든 순서쌍을 하나씩 잰다 (동시에 재면 서로의 대역폭을 깎아 먹는다).
+// 소스마다 /api/probe-serve 로 데이터 서버를 하나 띄우고, 나머지 노드가 차례로 /api/probe 로 잰 뒤 내린다.
+void measure_links(const std::vector<NodePtr> &nodes, uint64_t bytes, int pings) {
+    for (auto &src : nodes) {
+        auto scli = ctrl_client(src->host, src->ctrl_port);
+        scli.set_connection_timeout(3, 0);
+        scli.set_read_timeout(10, 0);
+        json sb = {{"host", src->host}, {"ttlSec", 60 + 30 * (int)nodes.size()}};
+        auto sr = scli.Post("/api/probe-serve", sb.dump(), "application/json");
+        json served;
+        if (sr && sr->status == 200) {
+            try { served = json::parse(sr->body); } catch (...) {}
+        }
+        for (auto &dst : nodes) {
+            if (dst == src) continue;
+            LinkStat l;
+            l.measured_at = (uint64_t)std::time(nullptr);
+            if (!served.contains("url")) {
+                l.error = sr ? "probe-serve " + std::to_string(sr->status) : "source unreachable";
+            } else {
+                auto dcli = ctrl_client(dst->host, dst->ctrl_port);
+                dcli.set_connection_timeout(3, 0);
+                dcli.set_read_timeout(120, 0);
+                json db = {{"url", served["url"]}, {"bytes", bytes}, {"pings", pings}};
+                auto dr = dcli.Post("/api/probe", db.dump(), "application/json");
+                try {
+                    json r = dr ? json::parse(dr->body) : json();
+                    if (dr && dr->status == 200) {
+                        l.bytes_per_sec = r.value("bytesPerSec", 0.0);
+                        l.rtt_ms = r.value("rttMs", 0.0);
+                    } else {
+                        l.error = dr ? r.value("error", "probe " + std::to_string(dr->status)) : "target unreachable";
+                    }
+                } catch (...) {
+                    l.error = "invalid probe reply";
+                }
+            }
+            g_links.set(src->key(), dst->key(), l);
+            g_links.step();
+        }
+        if (served.contains("id")) {
+            scli.Post("/api/probe-stop", json({{"id", served["id"]}}).dump(), "application/json");
+        }
+    }
+}
+
+// ---------------- broadcast tree ----------------
+// send-all topology: 누가 누구에게 보낼지 정한다. kids[i] 는 targets[i] 가 받은 뒤 다시 보낼 대상,
+// kids[targets.size()] 는 소스가 직접 보낼 대상 (보낼 순서대로).
+//  - zone "dc1/rack3" 은 '/' 단계마다 묶는다. 보내는 쪽과 다른 묶음에는 대표 한 노드에만 보내고
+//    대표가 묶음 안에서 같은 방식으로 다시 나눈다 → dc 사이, rack 사이 링크는 묶음마다 한 번만 지난다.
+//    대표는 같은 파일이 이미 있는 노드 > 과부하 아닌 노드 > 보내는 쪽에서 잰 대역폭이 큰 노드 > 앞 순서.
+//  - zone 없는 노드는 링크 측정(/api/measure)으로 소스에서의 병목 대역폭이 가장 큰 경로에 붙인다
+//    (maximum bottleneck tree). 소스 직접보다 1.2배 넘게 빠를 때만 중계하고, 측정이 없으면 소스가 직접 보낸다.
+std::vector<std::vector<std::size_t>> plan_broadcast_tree(const std::string &src_key, const std::string &src_zone,
+                                                          const std::vector<NodePtr> &targets,
+                                                          const std::vector<char> &present,
+                                                          const std::set<std::string> &deferred) {
+    const std::size_t SOURCE = targets.size();
+    std::vector<std::vector<std::size_t>> kids(SOURCE + 1);
+    std::vector<std::vector<std::string>> zones(SOURCE + 1);
+    for (std::size_t i = 0; i < SOURCE; ++i) zones[i] = split_list(targets[i]->zone, '/');
+    zones[SOURCE] = split_list(src_zone, '/');
+    auto bw = [&](std::size_t from, std::size_t to) {
+        LinkStat l;
+        const std::string &fk = from == SOURCE ? src_key : targets[from]->key();
+        return g_links.get(fk, targets[to]->key(), l) ? l.bytes_per_sec : 0.0;
+    };
+
+    // from 과 nodes 는 zone 앞 depth 단계가 같다
+    std::function<void(std::size_t, const std::vector<std::size_t> &, std::size_t)> plan =
+        [&](std::size_t from, const std::vector<std::size_t> &nodes, std::size_t depth) {
+        std::vector<std::pair<std::string, std::vector<std::size_t>>> groups; // 처음 나온 순서
+        std::vector<std::size_t> leaves, own;
+        for (auto i : nodes) {
+            if (zones[i].size() <= depth) {
+                leaves.push_back(i);
+                continue;
+            }
+            const std::string &z = zones[i][depth];
+            if (zones[from].size() > depth && zones[from][depth] == z) {
+                own.push_back(i);
+                continue;
+            }
+            auto g = std::find_if(groups.begin(), groups.end(), [&](const auto &e) { return e.first == z; });
+            if (g == groups.end()) groups.push_back({z, {i}});
+            else g->second.push_back(i);
+        }
+        // 대표부터 보내야 다른 묶음이 일찍 시작한다
+        for (auto &g : groups) {
+            auto better = [&](std::size_t a, std::size_t b) {
+                if (present[a] != present[b]) return present[a] > present[b];
+                bool da = deferred.count(targets[a]->key()) > 0, db = deferred.count(targets[b]->key()) > 0;
+                if (da != db) return db;
+                return bw(from, a) > bw(from, b);
+            };
+            std::size_t lead = *std::min_element(g.second.begin(), g.second.end(), better);
+            kids[from].push_back(lead);
+            std::vector<std::size_t> rest;
+            for (auto i : g.second) {
+                if (i != lead) rest.push_back(i);
+            }
+            plan(lead, rest, depth + 1);
+        }
+        if (!own.empty()) plan(from, own, depth + 1);
+        kids[from].insert(kids[from].end(), leaves.begin(), leaves.end());
+    };
+
+    std::vector<std::size_t> labeled, unlabeled;
+    for (std::size_t i = 0; i < SOURCE; ++i) (zones[i].empty() ? unlabeled : labeled).push_back(i);
+    plan(SOURCE, labeled, 0);
+
+    std::vector<double> best(SOURCE, 0);
+    std::vector<std::size_t> parent(SOURCE, SOURCE);
+    for (auto i : unlabeled) best[i] = bw(SOURCE, i);
+    while (!unlabeled.empty()) {
+        auto it = std::max_element(unlabeled.begin(), unlabeled.end(),
+                                   [&](std::size_t a, std::size_t b) { return best[a] < best[b]; });
+        std::size_t p = *it;
+        unlabeled.erase(it);
+        kids[parent[p]].push_back(p);
+        for (auto i : unlabeled) {
+            double b = std::min(best[p], bw(p, i));
+            if (b > best[i] * 1.2) {
+                best[i] = b;
+                parent[i] = p;
+            }
+        }
+    }
+    return kids;
+}
+
+// 과부하: 코어당 1분 load 가 max_load 를 넘거나 스케줄러 슬롯이 다 찼다
+bool resources_overloaded(const json &r, double max_load) {
+    double cpus = std::max(1.0, r.value("cpus", 1.0));
+    if (max_load > 0 && r.value("load1", 0.0) / cpus > max_load) return true;
+    int max_active = r.value("maxActive", 0);
+    return max_active > 0 && r.value("active", 0) >= max_active;
+}
+
+// ---------------- transfer scheduler ----------------
+// 노드 단위 전송 스케줄러 (/api/send-file 진입 제어).
+//  - priority 가 높은 작업부터, 같은 priority 는 도착 순서대로 진입
+//  - max_active: 동시 실행 전송 수 상한, max_bytes: 동시 실행 바이트 합 상한 (0 = 무제한)
+//  - 실행 중인 작업이 없으면 max_bytes 보다 큰 작업도 진입시킨다 (교착 방지)
+// 이미 실행 중인 전송을 끊지는 않는다. 급한 작업은 대기열 맨 앞으로 끼어드는 방식으로 선점한다.
+int parse_priority(const json &v) {
+    if (v.is_number_integer()) return v.get<int>();
+    if (v.is_string()) {
+        std::string s = v.get<std::string>();
+        if (s == "urgent") return 20;
+        if (s == "high") return 10;
+        if (s == "normal" || s.empty()) return 0;
+        if (s == "low" || s == "bulk") return -10;
+        return std::stoi(s);
+    }
+    return 0;
+}
+
+class TransferScheduler {
+public:
+    class Ticket {
+    public:
+        Ticket(TransferScheduler *s, uint64_t bytes, uint64_t queued_ms)
+            : s_(s), bytes_(bytes), queued_ms_(queued_ms) {}
+        Ticket(const Ticket &) = delete;
+        Ticket &operator=(const Ticket &) = delete;
+        ~Ticket() { if (s_) s_->release(bytes_); }
+        uint64_t queued_ms() const { return queued_ms_; }
+    private:
+        TransferScheduler *s_;
+        uint64_t bytes_;
+        uint64_t queued_ms_;
+    };
+
+    void configure(int max_active, uint64_t max_bytes) {
+        std::lock_guard<std::mutex> lk(mu_);
+        max_active_ = max_active;
+        max_bytes_ = max_bytes;
+        cv_.notify_all();
+    }
+
+    std::unique_ptr<Ticket> acquire(int priority, uint64_t bytes) {
+        auto t0 = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> lk(mu_);
+        Waiter w{-priority, next_seq_++};
+        queue_.insert(w);
+        cv_.wait(lk, [&] { return *queue_.begin() == w && fits(bytes); });
+        queue_.erase(queue_.begin());
+        active_++;
+        active_bytes_ += bytes;
+        cv_.notify_all(); // 다음 대기자도 들어갈 수 있는지 다시 확인
+        auto waited = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - t0).count();
+        return std::make_unique<Ticket>(this, bytes, (uint64_t)waited);
+    }
+
+    json stats() const {
+        std::lock_guard<std::mutex> lk(mu_);
+        json j;
+        j["active"] = active_;
+        j["activeBytes"] = active_bytes_;
+        j["queued"] = queue_.size();
+        j["maxActive"] = max_active_;
+        j["maxBytes"] = max_bytes_;
+        return j;
+    }
+
+private:
+    // (음수 priority, 도착 순번) 오름차순 = 높은 priority 먼저, 같으면 FIFO
+    struct Waiter {
+        int neg_priority;
+        uint64_t seq;
+        bool operator<(const Waiter &o) const {
+            return neg_priority != o.neg_priority ? neg_priority < o.neg_priority : seq < o.seq;
+        }
+        bool operator==(const Waiter &o) const { return seq == o.seq; }
+    };
+
+    bool fits(uint64_t bytes) const {
+        if (max_active_ > 0 && active_ >= max_active_) return false;
+        if (max_bytes_ > 0 && active_ > 0 && active_bytes_ + bytes > max_bytes_) return false;
+        return true;
+    }
+
+    void release(uint64_t bytes) {
+        std::lock_guard<std::mutex> lk(mu_);
+        active_--;
+        active_bytes_ -= bytes;
+        cv_.notify_all();
+    }
+
+    mutable std::mutex mu_;
+    std::condition_variable cv_;
+    std::set<Waiter> queue_;
+    uint64_t next_seq_ = 0;
+    int max_active_ = 0;
+    uint64_t max_bytes_ = 0;
+    int active_ = 0;
+    uint64_t active_bytes_ = 0;
+};
+
+TransferScheduler g_scheduler;
+
+// ---------------- configs ----------------
+struct ControlConfig {
+    std::string bind_host;
+    int bind_port;
+    bool is_master = false;
+    std::string master_host;
+    int master_port = 7000;
+    std::string public_host;
+    std::string node_name;
+    std::string zone;               // 위치 라벨 "dc/rack" (send-all topology 용)
+    int ctrl_threads = 64;
+    int max_transfers = 0;          // 0 = 무제한
+    uint64_t max_transfer_bytes = 0; // 0 = 무제한
+    uint64_t node_rate_limit = 0;    // bytes/s, 송신·수신 각각. 0 = 무제한
+    uint64_t target_rate_limit = 0;  // bytes/s, 대상 호스트별 송신
+    int data_port_lo = 0;            // 데이터 포트 범위. 0 = 요청 포트 → 임시 포트
+    int data_port_hi = 0;
+    int heartbeat_sec = 10;          // 워커 → 마스터 heartbeat 주기
+    int node_ttl_sec = 30;           // 마스터: 이 시간 동안 소식 없는 노드는 send-all 에서 제외 (0 = 끔)
+    int node_evict_sec = 600;        // 마스터: 이 시간 동안 소식 없는 노드는 목록에서 제거 (0 = 끔)
+    std::vector<std::string> disk_paths; // heartbeat 에 남은 용량을 보고할 경로 (cwd, --cas-dir 외)
+    bool gossip = false;             // 마스터 없이 gossip 으로 멤버 목록 유지
+    std::vector<std::string> seeds;  // gossip 합류용 host:port
+    int gossip_interval_ms = 1000;
+    int gossip_suspect_ms = 5000;    // suspect → dead 까지
+    std::string registry_file;       // 마스터: 노드 목록 스냅샷 파일 (재시작 시 다시 읽음)
+};
+
+struct SendConfig {
+    std::string source_host;
+    int source_ctrl_port;
+    std::string source_file;
+    std::string target_host;
+    int target_ctrl_port;
+    std::string target_save;
+    int send_port;
+    PackMode pack_mode;
+    bool auto_extract;
+    bool progress;
+    bool is_dir;
+    std::string priority;
+    uint64_t rate_limit = 0;
+    uint64_t target_rate_limit = 0;
+    int batch_size = 0;  // RAW 배치 크기, 0 = 소스 기본값
+    int connections = 0; // RAW 배치 수신 연결 수, 0 = 기본값
+    int parallel = 0;    // RAW 동시 전송 워커 수, 0 = 기본값
+    bool bundle = false; // RAW 작은 파일 묶음 전송
+    uint64_t bundle_threshold = 0; // 0 = 소스 기본값
+    std::string result_mode;       // RAW 결과 형식: full | summary | stream
+    bool sync = false;             // RAW 대상에 이미 있는 파일 건너뛰기
+    bool sync_hash = false;        // sync 비교를 내용 해시로
+    bool no_hardlinks = false;     // RAW hardlink 감지 끄기
+    bool dedupe = false;           // RAW 내용이 같은 파일은 한 번만 전송
+    bool no_local_copy = false;    // 같은 머신이어도 네트워크로 전송
+    std::string transport;         // auto | copy | uds | shm | tcp (빈 값 = auto)
+    bool cas = false;              // 해시를 보내 대상 저장소에 있으면 네트워크 없이 꺼내게 함
+};
+
+struct SendAllConfig {
+    std::string master_host;
+    int master_port;
+    std::string source_host;
+    int source_ctrl_port;
+    std::string source_file;
+    int send_port;
+    std::string target_save;
+    PackMode pack_mode;
+    bool auto_extract;
+    bool progress;
+    bool is_dir;
+    std::string priority;
+    uint64_t rate_limit = 0;
+    uint64_t target_rate_limit = 0;
+    int batch_size = 0;  // RAW 배치 크기, 0 = 소스 기본값
+    int connections = 0; // RAW 배치 수신 연결 수, 0 = 기본값
+    int parallel = 0;    // RAW 동시 전송 워커 수, 0 = 기본값
+    bool bundle = false; // RAW 작은 파일 묶음 전송
+    uint64_t bundle_threshold = 0; // 0 = 소스 기본값
+    std::string result_mode;       // RAW 결과 형식: full | summary | stream
+    bool sync = false;             // RAW 대상에 이미 있는 파일 건너뛰기
+    bool sync_hash = false;        // sync 비교를 내용 해시로
+    bool no_hardlinks = false;     // RAW hardlink 감지 끄기
+    bool dedupe = false;           // RAW 내용이 같은 파일은 한 번만 전송
+    bool no_local_copy = false;    // 같은 머신이어도 네트워크로 전송
+    std::string transport;         // auto | copy | uds | shm | tcp (빈 값 = auto)
+    bool cas = false;              // 해시를 보내 대상 저장소에 있으면 네트워크 없이 꺼내게 함
+    bool skip_present = false;     // 같은 파일이 이미 있는 대상은 건너뜀
+    bool no_load_aware = false;    // 자원 보고에 따른 대상 순서/건너뛰기 끄기
+    bool topology = false;         // zone/링크 측정으로 중계 트리를 만들어 보냄
+};
+
+// forward
+void start_control_server(const ControlConfig &cfg);
+void start_send(const SendConfig &cfg);
+void start_send_all(const SendAllConfig &cfg);
+
+// ---------------- CONTROL SERVER ----------------
+// 컨트롤 API 라우트. TCP 서버와 unix socket 서버에 똑같이 붙인다.
+void register_control_routes(httplib::Server &svr, const ControlConfig &cfg) {
+    svr.Get("/api/health", [](const httplib::Request&, httplib::Response &res) {
+        json j; j["status"] = "ok";
+        j["nodeId"] = node_identity();
+        if (!g_ctrl_socket.empty()) j["ctrlSocket"] = g_ctrl_socket;
+        res.set_content(j.dump(), "application/json");
+    });
+
+    svr.Get("/api/scheduler", [](const httplib::Request&, httplib::Response &res) {
+        res.set_content(g_scheduler.stats().dump(), "application/json");
+    });
+
+    // MASTER (gossip 모드에서는 모든 노드)
+    if (cfg.is_master || cfg.gossip) {
+        svr.Post("/api/register-node", [](const httplib::Request &req, httplib::Response &res) {
+            try {
+                auto j = json::parse(req.body);
+                std::string host = j.value("host", "");
+                int ctrl_port = j.value("ctrlPort", 0);
+                std::string name = j.value("name", "");
+                std::string zone = j.value("zone", "");
+                if (host.empty() || ctrl_port == 0) {
                     res.status = 400;
                     res.set_content("{\"error\":\"host, ctrlPort required\"}", "application/json");
                     return;
                 }
                 uint64_t now = (uint64_t)std::time(nullptr);
-                std::lock_guard<std::mutex> lk(g_nodes_mutex);
-                bool found = false;
-                for (auto &n : g_nodes) {
-                    if (n.host == host && n.ctrl_port == ctrl_port) {
-                        n.last_seen = now;
-                        if (!name.empty()) n.name = name;
-                        found = true;
-                        break;
-                    }
-                }
-                if (!found) {
-                    NodeInfo ni{host, ctrl_port, name, now};
-                    g_nodes.push_back(ni);
+                if (g_nodes.upsert(host, ctrl_port, name, now, false, zone)) {
                     std::cout << "[MASTER] 노드 등록: " << host << ":" << ctrl_port
-                              << " (" << name << ")\n";
+                              << " (" << name << (zone.empty() ? "" : ", " + zone) << ")\n";
                 }
+                g_nodes.touch(host, ctrl_port, now, nullptr, heartbeat_resources(j));
                 json r; r["status"] = "ok";
                 res.set_content(r.dump(), "application/json");
             } catch (...) {
@@ -395,22 +3934,144 @@ void start_control_server(const ControlConfig &cfg) {
             }
         });
 
-        svr.Get("/api/nodes", [](const httplib::Request&, httplib::Response &res) {
+        // /api/heartbeat { host, ctrlPort } : 등록된 노드의 last_seen 갱신.
+        // 모르는 노드(마스터 재시작, 제거됨)면 404 → 워커가 다시 등록한다.
+        svr.Post("/api/heartbeat", [](const httplib::Request &req, httplib::Response &res) {
+            try {
+                auto j = json::parse(req.body);
+                std::string host = j.value("host", "");
+                int ctrl_port = j.value("ctrlPort", 0);
+                uint64_t now = (uint64_t)std::time(nullptr);
+                uint64_t prev = 0;
+                if (g_nodes.touch(host, ctrl_port, now, &prev, heartbeat_resources(j))) {
+                    if (g_node_ttl_sec && prev + g_node_ttl_sec < now) {
+                        std::cout << "[MASTER] 노드 복귀: " << host << ":" << ctrl_port << "\n";
+                        g_nodes.mark(host + ":" + std::to_string(ctrl_port));
+                    }
+                    res.set_content("{\"status\":\"ok\"}", "application/json");
+                    return;
+                }
+                res.status = 404;
+                res.set_content("{\"error\":\"unknown node\"}", "application/json");
+            } catch (...) {
+                res.status = 400;
+                res.set_content("{\"error\":\"invalid json\"}", "application/json");
+            }
+        });
+
+        // /api/nodes : 노드 목록 { version, total, offset, nodes }
+        //  ?offset=&limit=  페이지 (주소 순)
+        //  ?since=<version> 그 뒤로 바뀐 노드만 { version, since, nodes, removed }.
+        //                   변경 로그 밖이면 전체 목록에 full: true
+        //  ?pretty=1        들여쓰기 (기본은 한 줄)
+        // 인자 없는 전체 목록은 직렬화한 문자열을 version 과 초 단위 시각으로 재사용한다
+        // (lastSeen 이 초 단위라 같은 초 안의 폴링은 같은 본문을 받는다).
+        svr.Get("/api/nodes", [](const httplib::Request &req, httplib::Response &res) {
+            uint64_t now = (uint64_t)std::time(nullptr);
+            bool pretty = req.get_param_value("pretty") == "1";
+            auto dump = [pretty](const json &j) { return pretty ? j.dump(2) : j.dump(); };
+
+            if (req.has_param("since")) {
+                uint64_t since = std::strtoull(req.get_param_value("since").c_str(), nullptr, 10);
+                std::vector<std::string> keys;
+                uint64_t version = 0;
+                if (g_nodes.changes_since(since, keys, version)) {
+                    json j;
+                    j["version"] = version;
+                    j["since"] = since;
+                    j["nodes"] = json::array();
+                    j["removed"] = json::array();
+                    for (auto &k : keys) {
+                        auto n = g_nodes.find(k);
+                        if (n) j["nodes"].push_back(node_json(*n, now));
+                        else j["removed"].push_back(k);
+                    }
+                    res.set_content(dump(j), "application/json");
+                    return;
+                }
+            }
+
+            std::size_t offset = 0, limit = 0;
+            if (req.has_param("offset")) offset = std::strtoull(req.get_param_value("offset").c_str(), nullptr, 10);
+            if (req.has_param("limit")) limit = std::strtoull(req.get_param_value("limit").c_str(), nullptr, 10);
+            bool cacheable = !pretty && !req.has_param("since") && offset == 0 && limit == 0;
+
+            static std::mutex cache_mu;
+            static uint64_t cache_version = 0, cache_time = 0;
+            static std::shared_ptr<const std::string> cache_body;
+            uint64_t version = g_nodes.version();
+            if (cacheable) {
+                std::lock_guard<std::mutex> lk(cache_mu);
+                if (cache_body && cache_version == version && cache_time == now) {
+                    res.set_content(*cache_body, "application/json");
+                    return;
+                }
+            }
+
+            auto nodes = g_nodes.snapshot();
+            std::size_t end = limit ? std::min(nodes->size(), offset + limit) : nodes->size();
             json j;
-            {
-                std::lock_guard<std::mutex> lk(g_nodes_mutex);
-                json arr = json::array();
-                for (auto &n : g_nodes) {
-                    json nj;
-                    nj["host"] = n.host;
-                    nj["ctrlPort"] = n.ctrl_port;
-                    nj["name"] = n.name;
-                    nj["lastSeen"] = n.last_seen;
-                    arr.push_back(nj);
+            j["version"] = version;
+            j["total"] = nodes->size();
+            j["offset"] = offset;
+            if (req.has_param("since")) j["full"] = true;
+            json arr = json::array();
+            for (std::size_t i = offset; i < end; ++i) arr.push_back(node_json(*(*nodes)[i], now));
+            j["nodes"] = std::move(arr);
+            auto body = std::make_shared<const std::string>(dump(j));
+            if (cacheable) {
+                std::lock_guard<std::mutex> lk(cache_mu);
+                cache_version = version;
+                cache_time = now;
+                cache_body = body;
+            }
+            res.set_content(*body, "application/json");
+        });
+
+        // /api/measure { bytes(기본 16M), pings(기본 5), nodes: ["host:port", ...] (기본: 살아 있는 전부) }
+        // 노드 쌍마다 처리량/RTT 를 백그라운드에서 재고 바로 돌려준다. 결과와 진행은 /api/matrix.
+        svr.Post("/api/measure", [](const httplib::Request &req, httplib::Response &res) {
+            try {
+                auto j = req.body.empty() ? json::object() : json::parse(req.body);
+                uint64_t bytes = j.contains("bytes") ? json_size(j, "bytes") : (16ULL << 20);
+                int pings = j.value("pings", 5);
+                std::set<std::string> only;
+                if (j.contains("nodes") && j["nodes"].is_array()) {
+                    for (auto &k : j["nodes"]) {
+                        if (k.is_string()) only.insert(k.get<std::string>());
+                    }
+                }
+                std::vector<NodePtr> nodes;
+                uint64_t now = (uint64_t)std::time(nullptr);
+                for (auto &n : *g_nodes.snapshot()) {
+                    if (!node_alive(*n, now)) continue;
+                    if (!only.empty() && !only.count(n->key())) continue;
+                    nodes.push_back(n);
+                }
+                std::size_t pairs = nodes.size() * (nodes.size() - std::min<std::size_t>(1, nodes.size()));
+                if (!g_links.begin(pairs)) {
+                    res.status = 409;
+                    res.set_content("{\"error\":\"measurement already running\"}", "application/json");
+                    return;
                 }
-                j["nodes"] = arr;
+                std::cout << "[MASTER] 링크 측정 시작: 노드 " << nodes.size() << "개, " << pairs << "쌍\n";
+                std::thread([nodes, bytes, pings]() {
+                    measure_links(nodes, bytes, pings);
+                    g_links.end();
+                    std::cout << "[MASTER] 링크 측정 끝\n";
+                }).detach();
+                json r;
+                r["status"] = "started";
+                r["pairs"] = pairs;
+                res.set_content(r.dump(), "application/json");
+            } catch (...) {
+                res.status = 400;
+                res.set_content("{\"error\":\"invalid json\"}", "application/json");
             }
-            res.set_content(j.dump(2), "application/json");
+        });
+
+        svr.Get("/api/matrix", [](const httplib::Request &, httplib::Response &res) {
+            res.set_content(g_links.to_json().dump(), "application/json");
         });
 
         svr.Post("/api/send-all", [cfg](const httplib::Request &req, httplib::Response &res) {
@@ -424,6 +4085,29 @@ void start_control_server(const ControlConfig &cfg) {
                 std::string pack_mode_str = j.value("packMode", "none");
                 bool auto_extract = j.value("autoExtract", false);
                 bool progress = j.value("progress", false);
+                json priority = j.value("priority", json("normal"));
+                uint64_t rate_limit = json_size(j, "rateLimit");
+                uint64_t target_rate_limit = json_size(j, "targetRateLimit");
+                int batch_size = j.value("batchSize", 0);
+                int connections = j.value("connections", 0);
+                int parallel = j.value("parallel", 0);
+                bool bundle = j.value("bundle", false);
+                uint64_t bundle_threshold = json_size(j, "bundleThreshold");
+                // 대상별 결과는 master 가 JSON 으로 모으므로 stream 은 summary 로 바꿔 전달
+                std::string result_mode = j.value("resultMode", "");
+                if (result_mode == "stream") result_mode = "summary";
+                bool sync = j.value("sync", false);
+                bool sync_hash = j.value("syncHash", false);
+                bool hardlinks = j.value("hardlinks", true);
+                bool dedupe = j.value("dedupe", false);
+                bool local_copy = j.value("localCopy", true);
+                std::string transport = j.value("transport", "");
+                bool cas = j.value("cas", false);
+                bool skip_present = j.value("skipPresent", false);
+                bool load_aware = j.value("loadAware", true);
+                double max_load = j.value("maxLoadPerCpu", 2.0);
+                int defer_wait_sec = j.value("deferWaitSec", 30);
+                bool topology = j.value("topology", false);
 
                 if (source_host.empty() || source_file.empty()) {
                     res.status = 400;
@@ -444,38 +4128,231 @@ void start_control_server(const ControlConfig &cfg) {
                           << "\n  packMode: " << pack_mode_str
                           << "\n";
 
-                std::vector<NodeInfo> targets;
+                // heartbeat 가 끊긴 노드는 타임아웃을 기다리지 않도록 빼고 excluded 로 알린다
+                std::vector<NodePtr> targets;
+                json excluded = json::array();
                 {
-                    std::lock_guard<std::mutex> lk(g_nodes_mutex);
-                    for (auto &n : g_nodes) {
-                        if (n.host == source_host && n.ctrl_port == source_ctrl_port) continue;
+                    uint64_t now = (uint64_t)std::time(nullptr);
+                    for (auto &n : *g_nodes.snapshot()) {
+                        if (n->host == source_host && n->ctrl_port == source_ctrl_port) continue;
+                        if (!node_alive(*n, now)) {
+                            excluded.push_back({{"host", n->host}, {"ctrlPort", n->ctrl_port},
+                                                {"lastSeen", n->last_seen.load()}, {"reason", "stale"}});
+                            continue;
+                        }
                         targets.push_back(n);
                     }
                 }
+                if (!excluded.empty()) {
+                    std::cout << "[MASTER] 응답 없는 노드 " << excluded.size() << "개 제외\n";
+                }
+
+                json result;
+                result["sourceHost"] = source_host;
+                result["targets"] = json::array();
+                if (!excluded.empty()) result["excluded"] = std::move(excluded);
+
+                // loadAware: heartbeat 의 자원 보고로 대상 순서를 정한다.
+                //  - targetSave 디스크에 소스 크기만큼 자리가 없으면 보내지 않고 no-space 로 알린다
+                //    (폴더는 하위 파일 합, 압축 전송도 원본 크기로 본다)
+                //  - 과부하 노드(코어당 load > maxLoadPerCpu, 전송 슬롯 가득)는 맨 뒤로 미루고,
+                //    차례가 오면 deferWaitSec 까지 풀리기를 기다렸다가 보낸다
+                //  - 나머지는 실행 중 전송 수, 코어당 load, 수신 트래픽이 적은 순
+                // 자원 보고가 없는 노드(구버전)는 원래 순서대로 앞쪽 그룹에 둔다.
+                std::set<std::string> deferred;
+                if (load_aware && !targets.empty()) {
+                    uint64_t need = 0;
+                    {
+                        auto cli = ctrl_client(source_host, source_ctrl_port);
+                        cli.set_read_timeout(60, 0);
+                        auto r2 = cli.Get(httplib::append_query_params(
+                            "/api/file-info", {{"path", source_file}}));
+                        if (r2 && r2->status == 200) {
+                            try { need = json::parse(r2->body).value("size", (uint64_t)0); } catch (...) {}
+                        }
+                    }
+                    std::string dest = target_save;
+                    if (pm == PackMode::NONE && !auto_extract) {
+                        std::string name = fs::path(source_file).filename().string();
+                        dest = target_save.empty() ? name : (fs::path(target_save) / name).string();
+                    }
+                    struct Ranked {
+                        NodePtr node;
+                        bool overloaded;
+                        double score;
+                    };
+                    std::vector<Ranked> ranked;
+                    for (auto &n : targets) {
+                        auto r = n->resources();
+                        uint64_t free = 0;
+                        if (r && need && resources_free_bytes(*r, dest, free) && free < need &&
+                            target_free_bytes(n->host, n->ctrl_port, dest, free) && free < need) {
+                            std::cout << "[MASTER] 대상 → " << n->host << ":" << n->ctrl_port
+                                      << " 디스크 부족 (" << free << " < " << need << "), 건너뜀\n";
+                            result["targets"].push_back({{"host", n->host}, {"ctrlPort", n->ctrl_port},
+                                                         {"ok", false}, {"skipped", true},
+                                                         {"reason", "no-space"}, {"free", free},
+                                                         {"need", need}});
+                            continue;
+                        }
+                        Ranked k{n, false, 0};
+                        if (r) {
+                            k.overloaded = resources_overloaded(*r, max_load);
+                            double cpus = std::max(1.0, r->value("cpus", 1.0));
+                            k.score = r->value("active", 0) * 1e6 + r->value("load1", 0.0) / cpus * 1e3 +
+                                      r->value("netRxBps", 0.0) / 1e9;
+                        }
+                        ranked.push_back(k);
+                    }
+                    std::stable_sort(ranked.begin(), ranked.end(), [](const Ranked &a, const Ranked &b) {
+                        return a.overloaded != b.overloaded ? !a.overloaded : a.score < b.score;
+                    });
+                    targets.clear();
+                    for (auto &k : ranked) {
+                        if (k.overloaded) deferred.insert(k.node->key());
+                        targets.push_back(k.node);
+                    }
+                }
+
+                // skipPresent: 그대로 보내는 단일 파일이면 먼저 소스 파일의 크기/해시를 묻고,
+                // 대상마다 targetSave/<파일명> 을 물어 같은 대상은 보내지 않는다.
+                // (묶어 보내거나 풀어 저장하는 경우는 대상 경로를 알 수 없어 건너뛰지 않는다.
+                //  RAW 폴더는 sync/syncHash 로 파일 단위로 건너뛴다)
+                std::vector<char> present(targets.size(), 0);
+                if (skip_present && pm == PackMode::NONE && !auto_extract) {
+                    json src_info;
+                    {
+                        auto cli = ctrl_client(source_host, source_ctrl_port);
+                        cli.set_read_timeout(300, 0);
+                        auto r2 = cli.Get(httplib::append_query_params(
+                            "/api/file-info", {{"path", source_file}, {"hash", "1"}}));
+                        if (r2 && r2->status == 200) {
+                            try { src_info = json::parse(r2->body); } catch (...) {}
+                        }
+                    }
+                    if (src_info.value("exists", false) && src_info.contains("sha256")) {
+                        uint64_t src_size = src_info.value("size", (uint64_t)0);
+                        std::string src_hash = src_info.value("sha256", "");
+                        std::string name = fs::path(source_file).filename().string();
+                        std::string dest = target_save.empty() ? name
+                                           : (fs::path(target_save) / name).string();
+                        // 대상 확인은 동시에 (대상 쪽 해시가 오래 걸릴 수 있다)
+                        std::atomic<std::size_t> next{0};
+                        std::vector<std::thread> checkers;
+                        std::size_t n_check = std::min<std::size_t>(targets.size(), 16);
+                        for (std::size_t w = 0; w < n_check; ++w) {
+                            checkers.emplace_back([&]() {
+                                for (std::size_t i; (i = next++) < targets.size();) {
+                                    auto cli = ctrl_client(targets[i]->host, targets[i]->ctrl_port);
+                                    cli.set_connection_timeout(3, 0);
+                                    cli.set_read_timeout(300, 0);
+                                    // 크기가 다르면 해시는 볼 필요가 없으므로 두 번에 나눠 묻는다
+                                    auto ask = [&](bool hash) {
+                                        httplib::Params q{{"path", dest}};
+                                        if (hash) q.emplace("hash", "1");
+                                        auto r2 = cli.Get(httplib::append_query_params("/api/file-info", q));
+                                        json info;
+                                        if (r2 && r2->status == 200) {
+                                            try { info = json::parse(r2->body); } catch (...) {}
+                                        }
+                                        return info;
+                                    };
+                                    json info = ask(false);
+                                    if (!info.value("exists", false) ||
+                                        info.value("size", (uint64_t)0) != src_size) continue;
+                                    present[i] = ask(true).value("sha256", "") == src_hash;
+                                }
+                            });
+                        }
+                        for (auto &th : checkers) th.join();
+                    } else {
+                        std::cout << "[MASTER] 소스 파일 정보를 못 얻음 → 사전 확인 생략\n";
+                    }
+                }
+
+                // topology: 중계 트리 (plan_broadcast_tree). 받은 노드는 targetSave/<이름> 을 다시 보내므로
+                // 받은 경로를 아는 전송(그대로 보내는 파일/RAW 폴더)만 중계한다.
+                const std::size_t SOURCE = targets.size();
+                std::string source_key = source_host + ":" + std::to_string(source_ctrl_port);
+                bool tree = topology && pm == PackMode::NONE && !auto_extract;
+                if (topology && !tree) {
+                    std::cout << "[MASTER] 묶거나 풀어 저장하는 전송은 중계할 경로를 몰라 topology 생략\n";
+                }
+                std::string relay_file = fs::path(source_file).filename().string();
+                if (!target_save.empty()) relay_file = (fs::path(target_save) / relay_file).string();
+                std::vector<std::vector<std::size_t>> kids(SOURCE + 1);
+                if (tree) {
+                    auto src = g_nodes.find(source_key);
+                    kids = plan_broadcast_tree(source_key, src ? src->zone : "", targets, present, deferred);
+                    result["topology"] = true;
+                } else {
+                    for (std::size_t ti = 0; ti < SOURCE; ++ti) kids[SOURCE].push_back(ti);
+                }
 
-                json result;
-                result["sourceHost"] = source_host;
-                result["targets"] = json::array();
-
-                for (auto &t : targets) {
-                    std::cout << "[MASTER] 대상 → " << t.host << ":" << t.ctrl_port << "\n";
+                // from 이 targets[ti] 에 보낸다 (from == SOURCE 면 소스)
+                std::atomic<std::size_t> skipped{0};
+                auto deliver = [&](std::size_t from, std::size_t ti) {
+                    auto &t = *targets[ti];
+                    std::string from_host = from == SOURCE ? source_host : targets[from]->host;
+                    int from_port = from == SOURCE ? source_ctrl_port : targets[from]->ctrl_port;
                     json tj;
                     tj["host"] = t.host;
                     tj["ctrlPort"] = t.ctrl_port;
+                    if (tree) tj["from"] = from == SOURCE ? source_key : targets[from]->key();
+                    if (present[ti]) {
+                        std::cout << "[MASTER] 대상 → " << t.host << ":" << t.ctrl_port
+                                  << " 같은 파일 있음, 건너뜀\n";
+                        tj["ok"] = true;
+                        tj["skipped"] = true;
+                        tj["reason"] = "identical";
+                        ++skipped;
+                        return tj;
+                    }
+                    if (deferred.count(t.key())) {
+                        // 미뤄 둔 노드: heartbeat 로 풀렸는지 보며 deferWaitSec 까지 기다린다
+                        tj["deferred"] = true;
+                        auto t0 = std::chrono::steady_clock::now();
+                        for (;;) {
+                            auto r = t.resources();
+                            if (!r || !resources_overloaded(*r, max_load)) break;
+                            if (elapsed_ms(t0) >= defer_wait_sec * 1000.0) break;
+                            std::this_thread::sleep_for(std::chrono::milliseconds(500));
+                        }
+                    }
+                    std::cout << "[MASTER] 대상 → " << t.host << ":" << t.ctrl_port
+                              << (from == SOURCE ? "" : " (중계 " + from_host + ":" + std::to_string(from_port) + ")")
+                              << (tj.contains("deferred") ? " (과부하로 미룸)" : "") << "\n";
+                    if (!t.verified) tj["unverified"] = true;
                     tj["ok"] = false;
 
-                    httplib::Client cli(source_host.c_str(), source_ctrl_port);
+                    auto cli = ctrl_client(from_host, from_port);
                     cli.set_read_timeout(300, 0);
 
                     json body;
-                    body["filePath"] = source_file;
+                    body["filePath"] = from == SOURCE ? source_file : relay_file;
                     body["dataPort"] = send_port;
-                    body["sourceHost"] = source_host;
+                    body["sourceHost"] = from_host;
                     body["targetHost"] = t.host;
                     body["targetCtrlPort"] = t.ctrl_port;
                     body["targetSave"] = target_save;
                     body["progress"] = progress;
                     body["autoExtract"] = auto_extract;
+                    body["priority"] = priority;
+                    if (rate_limit) body["rateLimit"] = rate_limit;
+                    if (target_rate_limit) body["targetRateLimit"] = target_rate_limit;
+                    if (batch_size) body["batchSize"] = batch_size;
+                    if (connections) body["connections"] = connections;
+                    if (parallel) body["parallel"] = parallel;
+                    if (bundle) body["bundle"] = true;
+                    if (bundle_threshold) body["bundleThreshold"] = bundle_threshold;
+                    if (!result_mode.empty()) body["resultMode"] = result_mode;
+                    if (sync) body["sync"] = true;
+                    if (sync_hash) body["syncHash"] = true;
+                    if (!hardlinks) body["hardlinks"] = false;
+                    if (dedupe) body["dedupe"] = true;
+                    if (!local_copy) body["localCopy"] = false;
+                    if (!transport.empty()) body["transport"] = transport;
+                    if (cas) body["cas"] = true;
                     if (pm == PackMode::TAR) body["packMode"] = "tar";
                     else if (pm == PackMode::GZ) body["packMode"] = "gz";
                     else if (pm == PackMode::TARGZ) body["packMode"] = "targz";
@@ -489,8 +4366,44 @@ void start_control_server(const ControlConfig &cfg) {
                     } else {
                         tj["error"] = res2 ? std::to_string(res2->status) : "no response";
                     }
-                    result["targets"].push_back(tj);
-                }
+                    return tj;
+                };
+
+                // 보내는 쪽마다 자기 대상에 차례로 보내고, 받은 대상이 다시 보낼 대상이 있으면 따로 돌게 한다.
+                // 중계할 노드가 받지 못하면 그 아래 대상은 보내던 쪽이 직접 맡는다.
+                std::mutex result_mu;
+                std::function<void(std::size_t)> run = [&](std::size_t from) {
+                    std::deque<std::size_t> queue(kids[from].begin(), kids[from].end());
+                    std::vector<std::thread> relays;
+                    while (!queue.empty()) {
+                        std::size_t ti = queue.front();
+                        queue.pop_front();
+                        // 중계 스레드에서 예외가 새면 마스터가 죽으므로 대상 하나의 실패로 돌린다
+                        json tj;
+                        try {
+                            tj = deliver(from, ti);
+                        } catch (const std::exception &e) {
+                            tj = {{"host", targets[ti]->host}, {"ctrlPort", targets[ti]->ctrl_port},
+                                  {"ok", false}, {"error", std::string("exception: ") + e.what()}};
+                        }
+                        bool ok = tj.value("ok", false);
+                        {
+                            std::lock_guard<std::mutex> lk(result_mu);
+                            result["targets"].push_back(std::move(tj));
+                        }
+                        if (kids[ti].empty()) continue;
+                        if (ok) {
+                            relays.emplace_back(run, ti);
+                        } else {
+                            std::cout << "[MASTER] 중계 노드 " << targets[ti]->key() << " 실패 → 아래 "
+                                      << kids[ti].size() << "개는 직접 보냄\n";
+                            queue.insert(queue.end(), kids[ti].begin(), kids[ti].end());
+                        }
+                    }
+                    for (auto &th : relays) th.join();
+                };
+                run(SOURCE);
+                if (skip_present) result["skipped"] = skipped.load();
 
                 res.set_content(result.dump(2), "application/json");
             } catch (...) {
@@ -501,6 +4414,7 @@ void start_control_server(const ControlConfig &cfg) {
     }
 
     // /api/download-file
+    // urls 에 소스가 둘 이상이면 구간을 나눠 동시에 받는다 (multi-source download).
     svr.Post("/api/download-file", [](const httplib::Request &req, httplib::Response &res) {
         try {
             auto j = json::parse(req.body);
@@ -509,6 +4423,17 @@ void start_control_server(const ControlConfig &cfg) {
             std::string save_dir = j.value("saveDir", "");
             bool progress = j.value("progress", false);
             bool auto_extract = j.value("autoExtract", false);
+            uint64_t rate_limit = json_size(j, "rateLimit");
+            std::vector<std::string> urls;
+            if (!url.empty()) urls.push_back(url);
+            if (j.contains("urls") && j["urls"].is_array()) {
+                for (auto &u : j["urls"]) {
+                    if (u.is_string() && std::find(urls.begin(), urls.end(), u.get<std::string>()) == urls.end()) {
+                        urls.push_back(u.get<std::string>());
+                    }
+                }
+            }
+            if (url.empty() && !urls.empty()) url = urls[0];
 
             if (url.empty() || file_name.empty()) {
                 res.status = 400;
@@ -520,49 +4445,700 @@ void start_control_server(const ControlConfig &cfg) {
             ensure_dir(dest_dir);
             fs::path dest_path = dest_dir / file_name;
 
-            if (!starts_with(url, "http://")) {
+            if (!starts_with(url, "http://") && !starts_with(url, "http+unix://")) {
                 res.status = 400;
                 res.set_content("{\"error\":\"only http:// supported\"}", "application/json");
                 return;
             }
-            std::string rest = url.substr(7);
-            std::size_t pos = rest.find('/');
-            if (pos == std::string::npos) {
+            std::string host, path;
+            int port = 80;
+            if (!parse_http_url(url, host, port, path)) {
                 res.status = 400;
                 res.set_content("{\"error\":\"invalid url\"}", "application/json");
                 return;
             }
-            std::string hostport = rest.substr(0, pos);
-            std::string path = rest.substr(pos);
-            std::string host = hostport;
-            int port = 80;
-            std::size_t colon = hostport.find(':');
-            if (colon != std::string::npos) {
-                host = hostport.substr(0, colon);
-                port = std::stoi(hostport.substr(colon + 1));
-            }
 
-            std::cout << "\n[CONTROL:DOWNLOAD] " << url << " → " << dest_path << "\n";
-            bool ok = http_download_file(host, port, path, dest_path, progress);
+            // 보내는 쪽이 sha256 을 알려 주면 저장소부터 찾는다 (--cas-dir)
+            std::string sha256 = j.value("sha256", "");
+            std::string cas_method;
+            bool cached = !sha256.empty() &&
+                          cas_fetch(sha256, j.value("size", (uint64_t)0), dest_path, &cas_method);
+
+            std::cout << "\n[CONTROL:DOWNLOAD] " << url << " → " << dest_path;
+            if (cached) std::cout << " (저장소 " << cas_method << ")";
+            else if (urls.size() > 1) std::cout << " (+" << urls.size() - 1 << " sources)";
+            std::cout << "\n";
+            RateLimits limits;
+            if (rate_limit) limits.transfer = std::make_shared<RateLimiter>(rate_limit);
+            limits.node = &g_node_recv_limiter;
+            json multi;
+            bool ok = cached;
+            // 저장소가 켜져 있으면 dest 가 저장소 항목의 hardlink 일 수 있으므로 잘라 쓰지 않고 새로 만든다
+            if (!cached && !g_cas_dir.empty()) ::unlink(dest_path.c_str());
+            if (!cached && urls.size() > 1) {
+                ok = multi_source_download(urls, dest_path, progress, limits,
+                                           j.value("connectionsPerSource", 2), multi);
+            } else if (!cached) {
+                ok = http_download_file(host, port, path, dest_path, progress, limits);
+            }
+            // RAW 파일별 전송은 소스의 mode/mtime 을 함께 보낸다 (다음 sync 에서 같은 파일로 보이도록).
+            // 저장소에 넣기 전에 입혀야 저장소 meta 와 어긋나지 않는다.
+            if (ok && j.contains("mtimeNs") && j["mtimeNs"].is_number_integer() &&
+                j.contains("mode") && j["mode"].is_number_unsigned()) {
+                apply_file_meta(dest_path, j["mode"].get<uint32_t>() & 07777, j["mtimeNs"].get<int64_t>());
+            }
+            if (ok && !cached) ok = cas_admit(dest_path, sha256);
             if (!ok) {
                 res.status = 500;
                 res.set_content("{\"error\":\"download failed\"}", "application/json");
                 return;
             }
 
-            if (auto_extract) {
-                if (!auto_extract_archive(dest_path)) {
-                    std::cerr << "[CONTROL:DOWNLOAD] extract failed\n";
-                }
-            }
+            if (auto_extract) {
+                if (!auto_extract_archive(dest_path)) {
+                    std::cerr << "[CONTROL:DOWNLOAD] extract failed\n";
+                }
+            }
+
+            json r;
+            r["status"] = "ok";
+            r["saved"] = dest_path.string();
+            if (cached) {
+                r["cached"] = true;
+                r["method"] = cas_method;
+            } else if (urls.size() > 1) {
+                r["multiSource"] = std::move(multi);
+            }
+            res.set_content(r.dump(), "application/json");
+        } catch (...) {
+            res.status = 400;
+            res.set_content("{\"error\":\"invalid json\"}", "application/json");
+        }
+    });
+
+    // /api/cas/<sha256> : 저장소 항목을 내보낸다 (Range 지원이라 multi-source 의 소스로 쓸 수 있다)
+    svr.Get(R"(/api/cas/([0-9a-f]{64}))", [](const httplib::Request &req, httplib::Response &res) {
+        fs::path obj;
+        std::string hex = req.matches[1];
+        if (!cas_lookup(hex, 0, &obj)) {
+            res.status = 404;
+            res.set_content("{\"error\":\"not in store\"}", "application/json");
+            return;
+        }
+        RateLimits limits;
+        limits.node = &g_node_send_limiter;
+        std::error_code ec;
+        uint64_t size = (uint64_t)fs::file_size(obj, ec);
+        if (ec || !set_file_content(res, obj, size, limits)) {
+            res.status = 500;
+            res.set_content("{\"error\":\"cannot open\"}", "application/json");
+        }
+    });
+
+    // /api/share-file : 로컬 파일을 ttlSec 동안 데이터 서버로 내놓는다 (multi-source 의 추가 소스용)
+    // { filePath, host(URL 에 쓸 이 노드 주소), ttlSec(기본 600), rateLimit } → { url, size }
+    svr.Post("/api/share-file", [](const httplib::Request &req, httplib::Response &res) {
+        try {
+            auto j = json::parse(req.body);
+            fs::path p = j.value("filePath", "");
+            std::string host = j.value("host", "");
+            int ttl = std::max(1, j.value("ttlSec", 600));
+            std::error_code ec;
+            if (p.empty() || host.empty() || !fs::is_regular_file(p, ec)) {
+                res.status = 400;
+                res.set_content("{\"error\":\"filePath (regular file), host required\"}",
+                                "application/json");
+                return;
+            }
+            ArchiveInfo ai;
+            ai.archive_path = p;
+            ai.archive_name = p.filename().string();
+            uint64_t size = (uint64_t)fs::file_size(p);
+            auto data = std::make_shared<DataServer>();
+            RateLimits limits;
+            uint64_t rate_limit = json_size(j, "rateLimit");
+            if (rate_limit) limits.transfer = std::make_shared<RateLimiter>(rate_limit);
+            limits.node = &g_node_send_limiter;
+            if (!serve_file_download(data->svr(), ai, size, limits) || !data->start("0.0.0.0", 0)) {
+                res.status = 503;
+                res.set_content("{\"error\":\"cannot start data server\"}", "application/json");
+                return;
+            }
+            std::string url = data->url(host, "/download");
+            // ttl 이 지나면 내린다
+            std::thread([data, ttl]() {
+                std::this_thread::sleep_for(std::chrono::seconds(ttl));
+                data->stop();
+            }).detach();
+            std::cout << "[CONTROL:SHARE] " << p << " → " << url << " (" << ttl << "s)\n";
+            json r;
+            r["status"] = "ok";
+            r["url"] = url;
+            r["size"] = size;
+            res.set_content(r.dump(), "application/json");
+        } catch (const std::exception &e) {
+            res.status = 400;
+            json j; j["error"] = std::string("exception: ") + e.what();
+            res.set_content(j.dump(), "application/json");
+        }
+    });
+
+    // 링크 측정 (마스터의 /api/measure 가 부른다)
+    // /api/probe-serve { host, ttlSec } → { id, url } : /ping 과 /probe?bytes=N 을 내는 데이터 서버를 띄운다.
+    //   /api/probe-stop { id } 로 내리고, 안 내리면 ttlSec 뒤에 내려간다.
+    // /api/probe { url, bytes, pings } → { rttMs, bytesPerSec } : url 의 서버로 RTT(중앙값)와 받기 속도를 잰다.
+    static std::mutex probe_mu;
+    static std::map<uint64_t, std::shared_ptr<DataServer>> probe_servers;
+    static std::atomic<uint64_t> probe_seq{0};
+    svr.Post("/api/probe-serve", [](const httplib::Request &req, httplib::Response &res) {
+        try {
+            auto j = json::parse(req.body);
+            std::string host = j.value("host", "");
+            int ttl = std::max(1, j.value("ttlSec", 300));
+            auto data = std::make_shared<DataServer>();
+            data->svr().Get("/ping", [](const httplib::Request &, httplib::Response &res2) {
+                res2.set_content("ok", "text/plain");
+            });
+            data->svr().Get("/probe", [](const httplib::Request &req2, httplib::Response &res2) {
+                static const std::vector<char> zeros(DATA_CHUNK_SIZE, 0);
+                uint64_t n = std::min<uint64_t>(
+                    std::strtoull(req2.get_param_value("bytes").c_str(), nullptr, 10), 1ULL << 30);
+                res2.set_content_provider(n, "application/octet-stream",
+                    [](size_t, size_t length, httplib::DataSink &sink) {
+                        return sink.write(zeros.data(), std::min(length, zeros.size()));
+                    });
+            });
+            if (host.empty() || !data->start("0.0.0.0", 0)) {
+                res.status = host.empty() ? 400 : 503;
+                res.set_content("{\"error\":\"cannot start probe server\"}", "application/json");
+                return;
+            }
+            uint64_t id = ++probe_seq;
+            {
+                std::lock_guard<std::mutex> lk(probe_mu);
+                probe_servers[id] = data;
+            }
+            std::thread([id, ttl]() {
+                std::this_thread::sleep_for(std::chrono::seconds(ttl));
+                std::lock_guard<std::mutex> lk(probe_mu);
+                probe_servers.erase(id);
+            }).detach();
+            json r;
+            r["id"] = id;
+            r["url"] = data->url(host, "");
+            res.set_content(r.dump(), "application/json");
+        } catch (...) {
+            res.status = 400;
+            res.set_content("{\"error\":\"invalid json\"}", "application/json");
+        }
+    });
+
+    svr.Post("/api/probe-stop", [](const httplib::Request &req, httplib::Response &res) {
+        try {
+            uint64_t id = json::parse(req.body).value("id", (uint64_t)0);
+            std::shared_ptr<DataServer> data;
+            {
+                std::lock_guard<std::mutex> lk(probe_mu);
+                auto it = probe_servers.find(id);
+                if (it != probe_servers.end()) {
+                    data = it->second;
+                    probe_servers.erase(it);
+                }
+            }
+            if (data) data->stop();
+            res.set_content("{\"status\":\"ok\"}", "application/json");
+        } catch (...) {
+            res.status = 400;
+            res.set_content("{\"error\":\"invalid json\"}", "application/json");
+        }
+    });
+
+    svr.Post("/api/probe", [](const httplib::Request &req, httplib::Response &res) {
+        try {
+            auto j = json::parse(req.body);
+            std::string host, path;
+            int port = 0;
+            uint64_t bytes = std::min<uint64_t>(json_size(j, "bytes"), 1ULL << 30);
+            if (bytes == 0) bytes = 16ULL << 20;
+            int pings = std::max(1, std::min(j.value("pings", 5), 100));
+            if (!parse_http_url(j.value("url", ""), host, port, path)) {
+                res.status = 400;
+                res.set_content("{\"error\":\"invalid url\"}", "application/json");
+                return;
+            }
+            auto cli = make_client(host, port);
+            cli.set_connection_timeout(3, 0);
+            cli.set_read_timeout(60, 0);
+            cli.set_keep_alive(true);
+            cli.set_tcp_nodelay(true);
+            // 첫 요청은 연결 수립이 섞이므로 빼고, 나머지의 중앙값
+            std::vector<double> rtts;
+            for (int i = 0; i <= pings; ++i) {
+                auto t0 = std::chrono::steady_clock::now();
+                auto r = cli.Get("/ping");
+                if (!r || r->status != 200) {
+                    res.status = 502;
+                    res.set_content("{\"error\":\"ping failed\"}", "application/json");
+                    return;
+                }
+                if (i > 0) rtts.push_back(elapsed_ms(t0));
+            }
+            std::sort(rtts.begin(), rtts.end());
+            uint64_t got = 0;
+            auto t0 = std::chrono::steady_clock::now();
+            auto r = cli.Get("/probe?bytes=" + std::to_string(bytes),
+                             [&](const char *, size_t len) {
+                                 got += len;
+                                 return true;
+                             });
+            double ms = elapsed_ms(t0);
+            if (!r || r->status != 200 || got != bytes) {
+                res.status = 502;
+                res.set_content("{\"error\":\"throughput probe failed\"}", "application/json");
+                return;
+            }
+            json out;
+            out["rttMs"] = rtts[rtts.size() / 2];
+            out["bytes"] = got;
+            out["bytesPerSec"] = ms > 0 ? (uint64_t)(got * 1000.0 / ms) : 0;
+            res.set_content(out.dump(), "application/json");
+        } catch (...) {
+            res.status = 400;
+            res.set_content("{\"error\":\"invalid json\"}", "application/json");
+        }
+    });
+
+    // /api/download-batch : RAW 디렉토리 배치 수신
+    //  - JSON   : { url: "http://src:port", saveDir, connections, rateLimit, files: [{id, path, mode, mtimeNs}] }
+    //             mode/mtimeNs 는 모든 항목에 있을 때만 복원한다 (구버전 소스는 안 보냄)
+    //  - 바이너리: Content-Type application/x-p2p-manifest 본문 (id 포함 manifest),
+    //             옵션은 query (?url=&saveDir=&connections=&rateLimit=). mode/mtime 도 복원한다.
+    svr.Post("/api/download-batch", [](const httplib::Request &req, httplib::Response &res) {
+        try {
+            json j;
+            std::unique_ptr<ManifestReader> manifest;
+            if (req.get_header_value("Content-Type") == "application/x-p2p-manifest") {
+                manifest.reset(new ManifestReader(req.body.data(), req.body.size()));
+                if (!manifest->valid() || !(manifest->flags() & MANIFEST_HAS_IDS)) {
+                    res.status = 415; // 소스는 이것만 보고 JSON 목록으로 다시 보낸다
+                    res.set_content("{\"error\":\"invalid manifest\"}", "application/json");
+                    return;
+                }
+                j["url"] = req.get_param_value("url");
+                j["saveDir"] = req.get_param_value("saveDir");
+                // connections 는 숫자가 아니면 기본값 (400 은 소스가 manifest 미지원으로 오해한다)
+                std::string conn = req.get_param_value("connections");
+                char *end = nullptr;
+                long c = std::strtol(conn.c_str(), &end, 10);
+                if (!conn.empty() && *end == '\0') j["connections"] = (int)std::max(1L, std::min(c, 16L));
+                if (req.has_param("rateLimit")) j["rateLimit"] = req.get_param_value("rateLimit");
+            } else {
+                j = json::parse(req.body);
+            }
+            std::string url = j.value("url", "");
+            std::string save_dir = j.value("saveDir", "");
+            int connections = std::max(1, std::min(j.value("connections", 4), 16));
+            uint64_t rate_limit = json_size(j, "rateLimit");
+            if (url.empty() || (!manifest && (!j.contains("files") || !j["files"].is_array()))) {
+                res.status = 400;
+                res.set_content("{\"error\":\"url, files required\"}", "application/json");
+                return;
+            }
+            // 워커 스레드 안에서 던지지 않도록 JSON 목록은 미리 모두 확인한다
+            bool apply_meta = (bool)manifest;
+            if (!manifest) {
+                apply_meta = true;
+                for (auto &f : j["files"]) {
+                    if (!f.is_object() || !f.value("path", json()).is_string() ||
+                        !f.value("id", json()).is_number_unsigned()) {
+                        res.status = 400;
+                        res.set_content("{\"error\":\"files: [{id, path}] required\"}", "application/json");
+                        return;
+                    }
+                    apply_meta = apply_meta && f.value("mode", json()).is_number_unsigned() &&
+                                 f.value("mtimeNs", json()).is_number_integer();
+                }
+            }
+            std::string host, path;
+            int port = 80;
+            if (!parse_http_url(url, host, port, path)) {
+                res.status = 400;
+                res.set_content("{\"error\":\"invalid url\"}", "application/json");
+                return;
+            }
+
+            fs::path dest_dir = save_dir.empty() ? fs::current_path() : fs::path(save_dir);
+            ensure_dir(dest_dir);
+
+            std::size_t count = manifest ? (std::size_t)manifest->count() : j["files"].size();
+            std::cout << "\n[CONTROL:BATCH] " << url << " → " << dest_dir
+                      << " (" << count << " files" << (manifest ? ", manifest" : "")
+                      << ", conn " << connections << ")\n";
+
+            RateLimits limits;
+            if (rate_limit) limits.transfer = std::make_shared<RateLimiter>(rate_limit);
+            limits.node = &g_node_recv_limiter;
+            std::size_t pos = 0;
+            const json &files = manifest ? j : j["files"];
+            auto next = [&](ManifestEntry &e) {
+                if (manifest) return manifest->next(e);
+                const json &f = files[pos];
+                e.id = f["id"].get<uint64_t>();
+                e.path = f["path"].get<std::string>();
+                if (apply_meta) {
+                    e.mode = f["mode"].get<uint32_t>() & 07777;
+                    e.mtime_ns = f["mtimeNs"].get<int64_t>();
+                }
+                pos++;
+                return true;
+            };
+            json r = batch_download(host, port, dest_dir, next, count, apply_meta,
+                                    connections, limits);
+            res.set_content(r.dump(), "application/json");
+        } catch (const std::exception &e) {
+            res.status = 400;
+            json j; j["error"] = std::string("exception: ") + e.what();
+            res.set_content(j.dump(), "application/json");
+        }
+    });
+
+    // /api/copy-local : 같은 머신의 소스가 보낸 파일을 직접 복사 (/api/download-file 대응)
+    // { file: 소스 절대 경로, dev, ino, size, mtimeNs, fileName, saveDir, autoExtract, rateLimit }
+    // 원본이 안 보이거나 dev/ino/크기/mtime 이 다르면 409 (다른 머신) → 소스가 네트워크 전송으로 되돌아간다.
+    svr.Post("/api/copy-local", [](const httplib::Request &req, httplib::Response &res) {
+        try {
+            auto j = json::parse(req.body);
+            fs::path src = j.value("file", "");
+            std::string file_name = j.value("fileName", "");
+            std::string save_dir = j.value("saveDir", "");
+            bool auto_extract = j.value("autoExtract", false);
+            uint64_t rate_limit = json_size(j, "rateLimit");
+            if (src.empty() || file_name.empty()) {
+                res.status = 400;
+                res.set_content("{\"error\":\"file, fileName required\"}", "application/json");
+                return;
+            }
+            if (!local_file_matches(src, j)) {
+                res.status = 409;
+                res.set_content("{\"error\":\"source not visible\"}", "application/json");
+                return;
+            }
+
+            fs::path dest_dir = save_dir.empty() ? fs::current_path() : fs::path(save_dir);
+            ensure_dir(dest_dir);
+            fs::path dest_path = dest_dir / file_name;
+            std::cout << "\n[CONTROL:COPY] " << src << " → " << dest_path << "\n";
+
+            RateLimits limits;
+            if (rate_limit) limits.transfer = std::make_shared<RateLimiter>(rate_limit);
+            limits.node = &g_node_recv_limiter;
+            std::string method;
+            if (!local_copy_file(src, dest_path, limits, nullptr, &method)) {
+                res.status = 500;
+                res.set_content("{\"error\":\"copy failed\"}", "application/json");
+                return;
+            }
+            if (auto_extract && !auto_extract_archive(dest_path)) {
+                std::cerr << "[CONTROL:COPY] extract failed\n";
+            }
+
+            json r;
+            r["status"] = "ok";
+            r["saved"] = dest_path.string();
+            r["method"] = method;
+            res.set_content(r.dump(), "application/json");
+        } catch (...) {
+            res.status = 400;
+            res.set_content("{\"error\":\"invalid json\"}", "application/json");
+        }
+    });
+
+    // /api/download-shm : 같은 머신의 소스가 만든 memfd 링에서 받아 저장 (transport: "shm")
+    // { ring: "/proc/<pid>/fd/<fd>", size, fileName, saveDir, progress, autoExtract, rateLimit }
+    // 링을 열 수 없으면 409 → 소스가 네트워크 전송으로 되돌아간다.
+    svr.Post("/api/download-shm", [](const httplib::Request &req, httplib::Response &res) {
+        try {
+            auto j = json::parse(req.body);
+            std::string ring_path = j.value("ring", "");
+            uint64_t size = j.value("size", (uint64_t)0);
+            std::string file_name = j.value("fileName", "");
+            std::string save_dir = j.value("saveDir", "");
+            bool progress = j.value("progress", false);
+            bool auto_extract = j.value("autoExtract", false);
+            uint64_t rate_limit = json_size(j, "rateLimit");
+            if (ring_path.empty() || file_name.empty()) {
+                res.status = 400;
+                res.set_content("{\"error\":\"ring, fileName required\"}", "application/json");
+                return;
+            }
+            auto ring = ShmRing::attach(ring_path);
+            if (!ring) {
+                res.status = 409;
+                res.set_content("{\"error\":\"cannot attach ring\"}", "application/json");
+                return;
+            }
+
+            fs::path dest_dir = save_dir.empty() ? fs::current_path() : fs::path(save_dir);
+            ensure_dir(dest_dir);
+            fs::path dest_path = dest_dir / file_name;
+            std::cout << "\n[CONTROL:SHM] " << ring_path << " → " << dest_path << "\n";
+
+            RateLimits limits;
+            if (rate_limit) limits.transfer = std::make_shared<RateLimiter>(rate_limit);
+            limits.node = &g_node_recv_limiter;
+            std::ofstream ofs(dest_path, std::ios::binary | std::ios::trunc);
+            std::vector<char> buf(1 << 20);
+            uint64_t got = 0;
+            long n = 0;
+            while (ofs && (n = ring->read(buf.data(), buf.size())) > 0) {
+                limits.consume((uint64_t)n);
+                ofs.write(buf.data(), n);
+                got += (uint64_t)n;
+                if (progress && size) draw_progress(got, size);
+            }
+            if (progress && size) std::cout << std::endl;
+            ofs.close();
+            if (n != 0 || ofs.fail() || got != size) {
+                ring->close_reader();
+                res.status = 500;
+                res.set_content("{\"error\":\"shm transfer failed\"}", "application/json");
+                return;
+            }
+            if (auto_extract && !auto_extract_archive(dest_path)) {
+                std::cerr << "[CONTROL:SHM] extract failed\n";
+            }
+
+            json r;
+            r["status"] = "ok";
+            r["saved"] = dest_path.string();
+            r["bytes"] = got;
+            res.set_content(r.dump(), "application/json");
+        } catch (...) {
+            res.status = 400;
+            res.set_content("{\"error\":\"invalid json\"}", "application/json");
+        }
+    });
+
+    // /api/copy-local-batch : RAW 디렉토리 로컬 복사 (/api/download-batch 대응)
+    // { saveDir, rateLimit, files: [{src, path, dev, ino, size, mtimeNs}] } — 결과는 files 와 같은 순서.
+    // 원본 하나라도 소스가 본 것과 다르면 아무것도 복사하지 않고 409.
+    svr.Post("/api/copy-local-batch", [](const httplib::Request &req, httplib::Response &res) {
+        try {
+            auto j = json::parse(req.body);
+            std::string save_dir = j.value("saveDir", "");
+            uint64_t rate_limit = json_size(j, "rateLimit");
+            if (!j.contains("files") || !j["files"].is_array() || j["files"].empty()) {
+                res.status = 400;
+                res.set_content("{\"error\":\"files required\"}", "application/json");
+                return;
+            }
+            for (auto &f : j["files"]) {
+                if (!f.is_object() || !f.value("src", json()).is_string() ||
+                    !local_file_matches(f["src"].get<std::string>(), f)) {
+                    res.status = 409;
+                    res.set_content("{\"error\":\"source not visible\"}", "application/json");
+                    return;
+                }
+            }
+
+            fs::path dest_dir = save_dir.empty() ? fs::current_path() : fs::path(save_dir);
+            RateLimits limits;
+            if (rate_limit) limits.transfer = std::make_shared<RateLimiter>(rate_limit);
+            limits.node = &g_node_recv_limiter;
+
+            json results = json::array();
+            std::size_t failed = 0;
+            uint64_t total = 0;
+            fs::path last_dir;
+            for (auto &f : j["files"]) {
+                fs::path rel = f.value("path", "");
+                json r;
+                r["path"] = rel.generic_string();
+                if (!is_safe_relative(rel)) {
+                    r["ok"] = false;
+                    r["error"] = "unsafe path";
+                    failed++;
+                    results.push_back(std::move(r));
+                    continue;
+                }
+                fs::path dest = dest_dir / rel;
+                if (dest.parent_path() != last_dir) {
+                    last_dir = dest.parent_path();
+                    ensure_dir(last_dir);
+                }
+                uint64_t got = 0;
+                std::string method;
+                if (local_copy_file(f.value("src", ""), dest, limits, &got, &method)) {
+                    r["ok"] = true;
+                    r["saved"] = dest.string();
+                    r["method"] = method;
+                    total += got;
+                } else {
+                    r["ok"] = false;
+                    r["error"] = "copy failed";
+                    failed++;
+                }
+                results.push_back(std::move(r));
+            }
+            std::cout << "[CONTROL:COPY] " << dest_dir << " (" << results.size() << " files, "
+                      << failed << " failed)\n";
+            json out;
+            out["status"] = failed ? "partial" : "ok";
+            out["count"] = results.size();
+            out["failed"] = failed;
+            out["bytes"] = total;
+            out["results"] = std::move(results);
+            res.set_content(out.dump(), "application/json");
+        } catch (const std::exception &e) {
+            res.status = 400;
+            json j; j["error"] = std::string("exception: ") + e.what();
+            res.set_content(j.dump(), "application/json");
+        }
+    });
+
+    // /api/link-files : RAW 전송의 사본 만들기
+    // { saveDir, links: [{path, target, hard, mode, mtimeNs}] } — 둘 다 saveDir 기준 상대 경로.
+    // hard 면 hardlink, 아니면 target 을 복사한 뒤 mode/mtime 을 입힌다.
+    svr.Post("/api/link-files", [](const httplib::Request &req, httplib::Response &res) {
+        try {
+            auto j = json::parse(req.body);
+            std::string save_dir = j.value("saveDir", "");
+            if (!j.contains("links") || !j["links"].is_array()) {
+                res.status = 400;
+                res.set_content("{\"error\":\"links required\"}", "application/json");
+                return;
+            }
+            fs::path dest_dir = save_dir.empty() ? fs::current_path() : fs::path(save_dir);
+            json results = json::array();
+            std::size_t failed = 0;
+            for (auto &l : j["links"]) {
+                fs::path rel = l.value("path", "");
+                fs::path target = l.value("target", "");
+                json r;
+                r["path"] = rel.generic_string();
+                std::error_code ec;
+                if (!is_safe_relative(rel) || !is_safe_relative(target)) {
+                    ec = std::make_error_code(std::errc::permission_denied);
+                } else {
+                    fs::path dest = dest_dir / rel;
+                    ensure_dir(dest.parent_path());
+                    fs::remove(dest, ec);
+                    if (l.value("hard", false)) {
+                        fs::create_hard_link(dest_dir / target, dest, ec);
+                    } else if (fs::copy_file(dest_dir / target, dest, ec)) {
+                        apply_file_meta(dest, l.value("mode", 0644u), l.value("mtimeNs", (int64_t)0));
+                    }
+                    if (!ec) r["saved"] = dest.string();
+                }
+                r["ok"] = !ec;
+                if (ec) {
+                    r["error"] = ec.message();
+                    failed++;
+                }
+                results.push_back(std::move(r));
+            }
+            std::cout << "[CONTROL:LINK] " << dest_dir << " (" << results.size() << " links, "
+                      << failed << " failed)\n";
+            json out;
+            out["status"] = failed ? "partial" : "ok";
+            out["results"] = std::move(results);
+            res.set_content(out.dump(), "application/json");
+        } catch (const std::exception &e) {
+            res.status = 400;
+            json j; j["error"] = std::string("exception: ") + e.what();
+            res.set_content(j.dump(), "application/json");
+        }
+    });
+
+    // /api/manifest?path=<dir>&hash=1 : dir 아래 일반 파일의 바이너리 manifest (sync 모드용).
+    // 임시 파일에 흘려 쓴 뒤 mmap 해서 내보내므로 큰 트리도 메모리에 통째로 올리지 않는다.
+    svr.Get("/api/manifest", [](const httplib::Request &req, httplib::Response &res) {
+        fs::path dir = req.get_param_value("path");
+        bool with_hash = req.get_param_value("hash") == "1";
+        std::error_code ec;
+        if (dir.empty() || !fs::is_directory(dir, ec)) {
+            res.status = 404;
+            res.set_content("{\"error\":\"directory not found\"}", "application/json");
+            return;
+        }
+        fs::path tmp = fs::temp_directory_path() /
+                       ("p2p-manifest-srv-" + std::to_string(::getpid()) + "-" +
+                        std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())));
+        uint64_t count;
+        {
+            std::ofstream ofs(tmp, std::ios::binary | std::ios::trunc);
+            count = write_dir_manifest(dir, with_hash, ofs);
+        }
+        auto mf = std::make_shared<MappedFile>(tmp);
+        fs::remove(tmp, ec); // 매핑은 unlink 후에도 유효
+        if (!mf->data()) {
+            res.status = 500;
+            res.set_content("{\"error\":\"manifest failed\"}", "application/json");
+            return;
+        }
+        std::cout << "[CONTROL:MANIFEST] " << dir << " (" << count << " files, "
+                  << mf->size() << " bytes)\n";
+        res.set_content_provider(
+            mf->size(), "application/x-p2p-manifest",
+            [mf](size_t offset, size_t length, httplib::DataSink &sink) {
+                return sink.write((const char *)mf->data() + offset, length);
+            });
+    });
+
+    // /api/file-info?path=&hash=1 : 파일 하나의 크기/mtime (hash=1 이면 SHA-256 도). 폴더면 isDir, 크기 합.
+    //   free=1 이면 그 경로가 (아직 없으면 있는 가장 가까운 상위가) 놓인 파일시스템의 남은 바이트도.
+    // send-all 의 사전 확인용. 해시는 (inode, 크기, mtime) 이 같으면 다시 읽지 않는다.
+    svr.Get("/api/file-info", [](const httplib::Request &req, httplib::Response &res) {
+        fs::path p = req.get_param_value("path");
+        json r;
+        struct stat st;
+        bool found = !p.empty() && ::stat(p.c_str(), &st) == 0;
+        r["exists"] = found && S_ISREG(st.st_mode);
+        if (found && S_ISDIR(st.st_mode)) {
+            // 폴더는 하위 일반 파일 크기 합만 (send-all 의 디스크 확인용)
+            r["isDir"] = true;
+            r["size"] = estimate_transfer_bytes(p);
+        } else if (r["exists"]) {
+            r["size"] = (uint64_t)st.st_size;
+            r["mtimeNs"] = stat_mtime_ns(st);
+            std::string hex;
+            if (req.get_param_value("hash") == "1" && cached_file_sha256(p, hex)) r["sha256"] = hex;
+        }
+        if (req.get_param_value("free") == "1") {
+            uint64_t free = 0;
+            if (path_free_bytes(p.empty() ? fs::path(".") : p, free)) r["free"] = free;
+        }
+        res.set_content(r.dump(), "application/json");
+    });
+
+    // /api/download-bundle : 작은 파일 묶음 수신 { url: "http://src:port/bundle/<n>", saveDir, rateLimit }
+    svr.Post("/api/download-bundle", [](const httplib::Request &req, httplib::Response &res) {
+        try {
+            auto j = json::parse(req.body);
+            std::string url = j.value("url", "");
+            std::string save_dir = j.value("saveDir", "");
+            uint64_t rate_limit = json_size(j, "rateLimit");
+            std::string host, path;
+            int port = 80;
+            if (url.empty() || !parse_http_url(url, host, port, path)) {
+                res.status = 400;
+                res.set_content("{\"error\":\"valid url required\"}", "application/json");
+                return;
+            }
+
+            fs::path dest_dir = save_dir.empty() ? fs::current_path() : fs::path(save_dir);
+            ensure_dir(dest_dir);
+            std::cout << "\n[CONTROL:BUNDLE] " << url << " → " << dest_dir << "\n";
 
-            json r;
-            r["status"] = "ok";
-            r["saved"] = dest_path.string();
+            RateLimits limits;
+            if (rate_limit) limits.transfer = std::make_shared<RateLimiter>(rate_limit);
+            limits.node = &g_node_recv_limiter;
+            json r = bundle_download(host, port, path, dest_dir, limits);
             res.set_content(r.dump(), "application/json");
-        } catch (...) {
+        } catch (const std::exception &e) {
             res.status = 400;
-            res.set_content("{\"error\":\"invalid json\"}", "application/json");
+            json j; j["error"] = std::string("exception: ") + e.what();
+            res.set_content(j.dump(), "application/json");
         }
     });
 
@@ -579,6 +5155,9 @@ void start_control_server(const ControlConfig &cfg) {
             bool progress = j.value("progress", false);
             bool auto_extract = j.value("autoExtract", false);
             std::string pack_mode_str = j.value("packMode", "none");
+            int priority = parse_priority(j.value("priority", json(0)));
+            uint64_t rate_limit = json_size(j, "rateLimit");
+            uint64_t target_rate_limit = json_size(j, "targetRateLimit");
 
             if (file_path.empty() || source_host.empty() || target_host.empty()) {
                 res.status = 400;
@@ -604,178 +5183,266 @@ void start_control_server(const ControlConfig &cfg) {
                       << "\n  mode  : " << pack_mode_str
                       << "\n  data  : " << source_host << ":" << data_port
                       << "\n  target: " << target_host << ":" << target_ctrl_port
+                      << "\n  prio  : " << priority
                       << "\n";
 
+            // 스케줄러 진입: 슬롯이 날 때까지 대기. ticket 이 소멸될 때 슬롯 반환.
+            auto ticket = g_scheduler.acquire(priority, estimate_transfer_bytes(p));
+            if (ticket->queued_ms() > 0) {
+                std::cout << "[CONTROL:SEND] 대기 " << ticket->queued_ms() << "ms 후 시작\n";
+            }
+
+            // 같은 머신이면 대상이 커널 안에서 직접 복사 (localCopy: false 로 끔).
+            // 복사가 안 되면 데이터는 unix socket 으로 (양쪽 모두 --uds-dir 일 때, unixSocket: false 로 끔).
+            // transport 로 직접 고를 수도 있다: auto(기본) | copy | uds | shm | tcp
+            //  (shm 은 단일 파일/묶은 폴더 전송만. RAW 폴더는 auto 와 같이 처리)
+            std::string transport = j.value("transport", "auto");
+            if (transport == "shm" && fs::is_directory(p) && pm == PackMode::NONE && !auto_extract) {
+                transport = "auto";
+            }
+            LocalPeer peer = local_peer(target_host, target_ctrl_port);
+            bool local = j.value("localCopy", true) && peer.same &&
+                         (transport == "auto" || transport == "copy");
+            bool uds = j.value("unixSocket", true) && peer.same && !peer.ctrl_socket.empty() &&
+                       !g_uds_dir.empty() && (transport == "auto" || transport == "uds");
+            bool shm = transport == "shm" && peer.same;
+            if (local) std::cout << "[CONTROL:SEND] 대상이 같은 머신 → 로컬 복사\n";
+
+            // 대역폭 제한: 이 전송 전체 / 대상 호스트 / 노드 전체
+            RateLimits limits;
+            if (rate_limit) limits.transfer = std::make_shared<RateLimiter>(rate_limit);
+            limits.target = target_limiter(target_host);
+            if (target_rate_limit) limits.target_override = std::make_shared<RateLimiter>(target_rate_limit);
+            limits.node = &g_node_send_limiter;
+
             // ✅ RAW 디렉토리 전송 모드:
             // 폴더이고, packMode == NONE 이고, auto_extract == false 이면
             // tar/gzip 없이 디렉토리 내 모든 파일을 개별 파일로 전송한다.
-            // RAW 디렉토리 전송 모드
             if (fs::is_directory(p) && pm == PackMode::NONE && !auto_extract) {
                 std::cout << "[CONTROL:SEND] RAW 디렉토리 전송 모드 활성\n";
 
-                std::string top = p.filename().string(); // 최상위 폴더명
+                RawSendContext ctx;
+                ctx.source_host = source_host;
+                ctx.data_port = data_port;
+                ctx.target_host = target_host;
+                ctx.target_ctrl_port = target_ctrl_port;
+                ctx.target_save = target_save;
+                ctx.progress = progress;
+                ctx.rate_limit = rate_limit;
+                ctx.limits = limits;
+                ctx.batch = j.value("rawBatch", true);
+                ctx.batch_size = j.value("batchSize", 1000);
+                ctx.connections = std::max(1, std::min(j.value("connections", 4), 16));
+                ctx.parallel = std::max(1, std::min(j.value("parallel", 4), 32));
+                ctx.bundle = j.value("bundle", false);
+                if (j.contains("bundleThreshold")) ctx.bundle_threshold = json_size(j, "bundleThreshold");
+                if (j.contains("bundleBytes")) ctx.bundle_bytes = json_size(j, "bundleBytes");
+                ctx.sync_hash = j.value("syncHash", false);
+                ctx.sync = j.value("sync", false) || ctx.sync_hash;
+                ctx.hardlinks = j.value("hardlinks", true);
+                ctx.dedupe = j.value("dedupe", false);
+                ctx.local = local;
+                ctx.uds = uds;
+
+                std::string result_mode = j.value("resultMode", "full");
+                std::size_t window_files = j.value("windowFiles", (std::size_t)16384);
+                uint64_t queued_ms = ticket->queued_ms();
+
+                // stream: NDJSON 으로 파일별 결과를 바로 내보내고 마지막 줄에 요약.
+                // 응답을 쓰기 시작한 뒤에 전송이 돌아가므로 HTTP 상태는 항상 200 이고,
+                // 성공 여부는 마지막 summary 줄의 status 로 판단한다.
+                if (result_mode == "stream") {
+                    std::shared_ptr<TransferScheduler::Ticket> held(std::move(ticket));
+                    res.set_chunked_content_provider(
+                        "application/x-ndjson",
+                        [held, ctx, p, window_files, queued_ms](size_t, httplib::DataSink &sink) {
+                            // provider 안의 예외는 httplib 가 잡지 않아 프로세스가 죽으므로 여기서 잡는다
+                            RawResults results;
+                            results.mode = RawResults::STREAM;
+                            results.emit = [&sink](const std::string &line) {
+                                return sink.write(line.data(), line.size());
+                            };
+                            json sum;
+                            try {
+                                raw_send_directory(p, ctx, window_files, results);
+                                sum = results.summary();
+                                sum["status"] = results.failed ? "partial" : "ok";
+                            } catch (const std::exception &e) {
+                                sum = results.summary();
+                                sum["status"] = "error";
+                                sum["error"] = std::string("exception: ") + e.what();
+                            }
+                            if (results.aborted) {
+                                std::cout << "[CONTROL:SEND] stream 받는 쪽 끊김 → 전송 중단\n";
+                                return false;
+                            }
+                            sum["type"] = "summary";
+                            sum["mode"] = "raw-directory";
+                            sum["root"] = p.string();
+                            sum["queuedMs"] = queued_ms;
+                            std::string line = sum.dump(-1, ' ', false, json::error_handler_t::replace) + "\n";
+                            sink.write(line.data(), line.size());
+                            sink.done();
+                            return true;
+                        });
+                    return;
+                }
+
+                RawResults results;
+                results.mode = result_mode == "summary" ? RawResults::SUMMARY : RawResults::FULL;
+                raw_send_directory(p, ctx, window_files, results);
 
                 json result;
                 result["status"] = "ok";
                 result["mode"] = "raw-directory";
                 result["root"] = p.string();
-                json files = json::array();
-                bool any_failed = false;
-
-                for (auto &entry : fs::recursive_directory_iterator(p)) {
-                    if (!fs::is_regular_file(entry.path())) continue;
+                result["queuedMs"] = queued_ms;
+                if (results.mode == RawResults::FULL) {
+                    result["files"] = std::move(results.files);
+                } else {
+                    result["summary"] = results.summary();
+                    result["failures"] = std::move(results.failures);
+                }
+                res.status = results.failed ? 500 : 200;
+                res.set_content(results.mode == RawResults::FULL ? result.dump(2) : result.dump(),
+                                "application/json");
+                return;
+            }
 
-                    fs::path rel;
-                    try {
-                        rel = fs::relative(entry.path(), p);
-                    } catch (...) {
-                        rel = entry.path().filename();
+            // ✅ 기존 단일 파일(또는 tar/targz/gz로 묶인 폴더) 전송 로직
+            // 준비(압축) → 데이터 서버 bind/ready → 대상 통지 순서. 단계별 소요 시간을 응답에 싣는다.
+            auto t_setup = std::chrono::steady_clock::now();
+            ArchiveInfo ai = prepare_archive(p, pm, auto_extract);
+            auto size = fs::file_size(ai.archive_path);
+            // cas: 대상 저장소에 같은 내용이 있으면 네트워크 없이 꺼내도록 해시를 함께 보낸다
+            std::string sha256;
+            if (j.value("cas", false) && !cached_file_sha256(ai.archive_path, sha256)) sha256.clear();
+            double prepare_ms = elapsed_ms(t_setup);
+
+            if (local) {
+                json body2;
+                struct stat st {};
+                ::stat(ai.archive_path.c_str(), &st);
+                body2 = local_file_id((uint64_t)st.st_dev, (uint64_t)st.st_ino, (uint64_t)size,
+                                      stat_mtime_ns(st));
+                body2["file"] = fs::absolute(ai.archive_path).string();
+                body2["fileName"] = ai.archive_name;
+                body2["saveDir"] = target_save;
+                body2["autoExtract"] = auto_extract;
+                if (rate_limit) body2["rateLimit"] = rate_limit;
+
+                auto cli = ctrl_client(target_host, target_ctrl_port);
+                cli.set_read_timeout(300, 0);
+                auto t_copy = std::chrono::steady_clock::now();
+                auto res2 = cli.Post("/api/copy-local", body2.dump(), "application/json");
+                double transfer_ms = elapsed_ms(t_copy);
+                // 404(구버전) / 409(실제로는 다른 머신)면 아래 네트워크 전송으로 계속
+                if (!res2 || (res2->status != 404 && res2->status != 409)) {
+                    if (ai.cleanup) {
+                        std::error_code ec;
+                        fs::remove(ai.archive_path, ec);
                     }
+                    if (!res2 || res2->status != 200) {
+                        res.status = 500;
+                        res.set_content("{\"error\":\"target copy failed\"}", "application/json");
+                        return;
+                    }
+                    json r;
+                    r["status"] = "ok";
+                    r["queuedMs"] = ticket->queued_ms();
+                    r["local"] = true;
+                    r["transport"] = "copy";
+                    r["timing"] = {{"prepareMs", prepare_ms}, {"transferMs", transfer_ms}};
+                    try { r["detail"] = json::parse(res2->body); }
+                    catch (...) { r["detail_raw"] = res2->body; }
+                    res.set_content(r.dump(), "application/json");
+                    return;
+                }
+                std::cout << "[CONTROL:SEND] 대상이 로컬 복사 불가 → 네트워크 전송\n";
+            }
 
-                    // ⭐ 최상위 폴더 prepend
-                    fs::path raw_relative = fs::path(top) / rel;
-
-                    fs::path rel_parent = raw_relative.parent_path();
-
-                    fs::path dest_dir = target_save.empty()
-                                        ? rel_parent
-                                        : fs::path(target_save) / rel_parent;
-
-                    std::string dest_dir_str = dest_dir.string();
-
-                    std::cout << "[CONTROL:SEND] RAW 파일 전송: "
-                              << entry.path() << " -> " << dest_dir_str << "\n";
-
-                    json fj;
-                    fj["file"] = entry.path().string();
-                    fj["relative"] = raw_relative.string();
-                    fj["saveDir"] = dest_dir_str;
-
-                    try {
-                        ArchiveInfo ai = prepare_archive(entry.path(), PackMode::NONE, false);
-                        auto size = fs::file_size(ai.archive_path);
-
-                        auto svr_data = std::make_shared<httplib::Server>();
-                        auto ifs_ptr = std::make_shared<std::ifstream>(ai.archive_path, std::ios::binary);
-                        if (!ifs_ptr->is_open()) {
-                            any_failed = true;
-                            fj["ok"] = false;
-                            fj["error"] = "cannot open file";
-                            files.push_back(fj);
-                            continue;
+            // shm: memfd 링을 만들어 writer 스레드가 채우고, 대상은 /api/download-shm 으로 비운다
+            if (shm) {
+                auto ring = ShmRing::create(SHM_RING_BYTES);
+                if (ring) {
+                    ShmRing *rp = ring.get();
+                    fs::path src = ai.archive_path;
+                    std::thread writer([rp, src, limits]() {
+                        std::ifstream ifs(src, std::ios::binary);
+                        std::vector<char> buf(DATA_CHUNK_SIZE);
+                        bool ok = (bool)ifs;
+                        while (ok && ifs) {
+                            ifs.read(buf.data(), (std::streamsize)buf.size());
+                            auto n = (std::size_t)ifs.gcount();
+                            if (n == 0) break;
+                            limits.consume(n);
+                            ok = rp->write(buf.data(), n);
+                        }
+                        rp->finish(ok && !ifs.bad());
+                    });
+
+                    json body2;
+                    body2["ring"] = ring->proc_path();
+                    body2["size"] = (uint64_t)size;
+                    body2["fileName"] = ai.archive_name;
+                    body2["saveDir"] = target_save;
+                    body2["progress"] = progress;
+                    body2["autoExtract"] = auto_extract;
+                    if (rate_limit) body2["rateLimit"] = rate_limit;
+
+                    auto cli = ctrl_client(target_host, target_ctrl_port);
+                    cli.set_read_timeout(300, 0);
+                    auto t_shm = std::chrono::steady_clock::now();
+                    auto res2 = cli.Post("/api/download-shm", body2.dump(), "application/json");
+                    double transfer_ms = elapsed_ms(t_shm);
+                    if (!res2 || res2->status != 200) ring->close_reader(); // writer 를 풀어 준다
+                    writer.join();
+
+                    if (!res2 || (res2->status != 404 && res2->status != 409)) {
+                        if (ai.cleanup) {
+                            std::error_code ec;
+                            fs::remove(ai.archive_path, ec);
                         }
-
-                        svr_data->Get("/download", [ifs_ptr, size, ai](const httplib::Request&, httplib::Response &res2) {
-                            res2.set_header("Content-Type", "application/octet-stream");
-                            res2.set_header("Content-Disposition",
-                                            "attachment; filename=\"" + ai.archive_name + "\"");
-                            res2.set_header("Content-Length", std::to_string(size));
-                            res2.set_content_provider(
-                                size,
-                                "application/octet-stream",
-                                [ifs_ptr](size_t offset, size_t length, httplib::DataSink &sink) {
-                                    ifs_ptr->clear();
-                                    ifs_ptr->seekg((std::streamoff)offset, std::ios::beg);
-                                    std::vector<char> buf(length);
-                                    ifs_ptr->read(buf.data(), (std::streamsize)length);
-                                    auto read_bytes = (size_t)ifs_ptr->gcount();
-                                    if (read_bytes == 0) return false;
-                                    sink.write(buf.data(), read_bytes);
-                                    return true;
-                                }
-                            );
-                        });
-
-                        std::thread th([svr_data, data_port]() {
-                            svr_data->listen("0.0.0.0", data_port);
-                        });
-
-                        httplib::Client cli2(target_host.c_str(), target_ctrl_port);
-                        cli2.set_read_timeout(300, 0);
-                        std::string url = "http://" + source_host + ":" +
-                                          std::to_string(data_port) + "/download";
-
-                        json body2;
-                        body2["url"] = url;
-                        body2["fileName"] = ai.archive_name;
-                        body2["saveDir"] = dest_dir_str;
-                        body2["progress"] = progress;
-                        body2["autoExtract"] = false;
-
-                        auto res2 = cli2.Post("/api/download-file", body2.dump(), "application/json");
-                        svr_data->stop();
-                        if (th.joinable()) th.join();
-
                         if (!res2 || res2->status != 200) {
-                            any_failed = true;
-                            fj["ok"] = false;
-                            fj["error"] = res2 ? std::to_string(res2->status) : "no response";
-                        } else {
-                            fj["ok"] = true;
-                            try { fj["detail"] = json::parse(res2->body); }
-                            catch (...) { fj["detail_raw"] = res2->body; }
+                            res.status = 500;
+                            res.set_content("{\"error\":\"target shm download failed\"}", "application/json");
+                            return;
                         }
-                    } catch (const std::exception &e) {
-                        any_failed = true;
-                        fj["ok"] = false;
-                        fj["error"] = std::string("exception: ") + e.what();
-                    } catch (...) {
-                        any_failed = true;
-                        fj["ok"] = false;
-                        fj["error"] = "unknown exception";
+                        json r;
+                        r["status"] = "ok";
+                        r["queuedMs"] = ticket->queued_ms();
+                        r["transport"] = "shm";
+                        r["timing"] = {{"prepareMs", prepare_ms}, {"transferMs", transfer_ms}};
+                        try { r["detail"] = json::parse(res2->body); }
+                        catch (...) { r["detail_raw"] = res2->body; }
+                        res.set_content(r.dump(), "application/json");
+                        return;
                     }
-
-                    files.push_back(fj);
                 }
-
-                result["files"] = files;
-                res.status = any_failed ? 500 : 200;
-                res.set_content(result.dump(2), "application/json");
-                return;
+                std::cout << "[CONTROL:SEND] shm 링 사용 불가 → 네트워크 전송\n";
             }
 
-            // ✅ 기존 단일 파일(또는 tar/targz/gz로 묶인 폴더) 전송 로직
-            ArchiveInfo ai = prepare_archive(p, pm, auto_extract);
-            auto size = fs::file_size(ai.archive_path);
-
-            auto svr_data = std::make_shared<httplib::Server>();
-            auto ifs_ptr = std::make_shared<std::ifstream>(ai.archive_path, std::ios::binary);
-            if (!ifs_ptr->is_open()) {
+            DataServer data;
+            if (!serve_file_download(data.svr(), ai, size, limits)) {
                 res.status = 500;
                 res.set_content("{\"error\":\"cannot open archive\"}", "application/json");
                 return;
             }
+            if (!data.start("0.0.0.0", data_port, uds)) {
+                if (ai.cleanup) {
+                    std::error_code ec;
+                    fs::remove(ai.archive_path, ec);
+                }
+                res.status = 503;
+                res.set_content("{\"error\":\"no free data port\"}", "application/json");
+                return;
+            }
+            double setup_ms = elapsed_ms(t_setup);
+            std::string url = data.url(source_host, "/download");
+            std::cout << "[DATA] listen " << url << " (setup " << setup_ms << "ms)\n";
 
-            svr_data->Get("/download", [ifs_ptr, size, ai](const httplib::Request&, httplib::Response &res2) {
-                res2.set_header("Content-Type", "application/octet-stream");
-                res2.set_header("Content-Disposition",
-                                "attachment; filename=\"" + ai.archive_name + "\"");
-                res2.set_header("Content-Length", std::to_string(size));
-                res2.set_content_provider(
-                    size,
-                    "application/octet-stream",
-                    [ifs_ptr](size_t offset, size_t length, httplib::DataSink &sink) {
-                        ifs_ptr->clear();
-                        ifs_ptr->seekg((std::streamoff)offset, std::ios::beg);
-                        std::vector<char> buf(length);
-                        ifs_ptr->read(buf.data(), (std::streamsize)length);
-                        auto read_bytes = (size_t)ifs_ptr->gcount();
-                        if (read_bytes == 0) return false;
-                        sink.write(buf.data(), read_bytes);
-                        return true;
-                    }
-                );
-            });
-
-            std::thread th([svr_data, data_port]() {
-                std::cout << "[DATA] listen 0.0.0.0:" << data_port << "/download\n";
-                svr_data->listen("0.0.0.0", data_port);
-            });
-
-            httplib::Client cli(target_host.c_str(), target_ctrl_port);
+            auto cli = ctrl_client(target_host, target_ctrl_port);
             cli.set_read_timeout(300, 0);
-            std::string url = "http://" + source_host + ":" +
-                              std::to_string(data_port) + "/download";
 
             json body2;
             body2["url"] = url;
@@ -783,10 +5450,22 @@ void start_control_server(const ControlConfig &cfg) {
             body2["saveDir"] = target_save;
             body2["progress"] = progress;
             body2["autoExtract"] = auto_extract;
+            if (rate_limit) body2["rateLimit"] = rate_limit;
+            if (!sha256.empty()) {
+                body2["sha256"] = sha256;
+                body2["size"] = (uint64_t)size;
+            }
+            // 같은 파일을 가진 다른 소스 URL (예: /api/share-file) 이 있으면 대상이 나눠 받는다
+            if (j.contains("mirrors") && j["mirrors"].is_array() && !j["mirrors"].empty()) {
+                json urls = json::array({url});
+                for (auto &m : j["mirrors"]) urls.push_back(m);
+                body2["urls"] = std::move(urls);
+            }
 
+            auto t_notify = std::chrono::steady_clock::now();
             auto res2 = cli.Post("/api/download-file", body2.dump(), "application/json");
-            svr_data->stop();
-            if (th.joinable()) th.join();
+            double transfer_ms = elapsed_ms(t_notify);
+            data.stop();
 
             if (ai.cleanup) {
                 std::error_code ec;
@@ -801,6 +5480,10 @@ void start_control_server(const ControlConfig &cfg) {
 
             json r;
             r["status"] = "ok";
+            r["queuedMs"] = ticket->queued_ms();
+            r["dataPort"] = data.port();
+            r["timing"] = {{"prepareMs", prepare_ms}, {"bindMs", data.bind_ms()},
+                           {"setupMs", setup_ms}, {"transferMs", transfer_ms}};
             try { r["detail"] = json::parse(res2->body); }
             catch (...) { r["detail_raw"] = res2->body; }
             res.set_content(r.dump(), "application/json");
@@ -813,38 +5496,751 @@ void start_control_server(const ControlConfig &cfg) {
             res.set_content("{\"error\":\"invalid json\"}", "application/json");
         }
     });
+}
 
-    // WORKER: 마스터 등록
-    if (!cfg.is_master && !cfg.master_host.empty()) {
-        try {
-            std::string host_for_master = cfg.public_host.empty()
-                                          ? cfg.bind_host
-                                          : cfg.public_host;
-            httplib::Client cli(cfg.master_host.c_str(), cfg.master_port);
-            cli.set_read_timeout(5, 0);
+// ---------------- heartbeat ----------------
+// 백그라운드 루프용 정지 신호. wait_for 는 sec 동안 자다가 stop() 되면 바로 false.
+class StopFlag {
+public:
+    bool wait_for(double sec) {
+        std::unique_lock<std::mutex> lk(mu_);
+        return !cv_.wait_for(lk, std::chrono::duration<double>(sec), [this] { return stop_; });
+    }
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+    }
+
+private:
+    std::mutex mu_;
+    std::condition_variable cv_;
+    bool stop_ = false;
+};
+
+// heartbeat 에 싣는 워커 자원 상태:
+//  cwd/disk  : 현재 디렉토리(saveDir 기본값), --cas-dir, --disk-paths 의 남은 바이트
+//  netRxBps/netTxBps : lo 를 뺀 인터페이스 합계, 직전 샘플 이후 평균 bytes/s
+//  active/queued/maxActive : 전송 스케줄러 상태, load1/cpus : 1분 loadavg 와 코어 수
+class ResourceSampler {
+public:
+    explicit ResourceSampler(const std::vector<std::string> &extra) {
+        std::error_code ec;
+        paths_.push_back(fs::current_path(ec).string());
+        if (!g_cas_dir.empty()) paths_.push_back(fs::absolute(g_cas_dir, ec).string());
+        for (auto &p : extra) {
+            if (!p.empty()) paths_.push_back(fs::absolute(p, ec).string());
+        }
+    }
+
+    json sample() {
+        json r;
+        r["cwd"] = paths_[0];
+        r["disk"] = json::array();
+        for (auto &p : paths_) {
+            struct statvfs vs;
+            if (::statvfs(p.c_str(), &vs) != 0) continue;
+            r["disk"].push_back({{"path", p}, {"free", (uint64_t)vs.f_bavail * vs.f_frsize}});
+        }
+        uint64_t rx = 0, tx = 0;
+        auto now = std::chrono::steady_clock::now();
+        if (read_net_bytes(rx, tx)) {
+            double sec = std::chrono::duration<double>(now - prev_time_).count();
+            if (have_prev_ && sec > 0) {
+                r["netRxBps"] = (uint64_t)((rx - std::min(rx, prev_rx_)) / sec);
+                r["netTxBps"] = (uint64_t)((tx - std::min(tx, prev_tx_)) / sec);
+            }
+            prev_rx_ = rx;
+            prev_tx_ = tx;
+            prev_time_ = now;
+            have_prev_ = true;
+        }
+        json sched = g_scheduler.stats();
+        r["active"] = sched["active"];
+        r["queued"] = sched["queued"];
+        r["maxActive"] = sched["maxActive"];
+        double load1 = 0;
+        std::istringstream(read_first_line("/proc/loadavg")) >> load1;
+        r["load1"] = load1;
+        r["cpus"] = std::max(1u, std::thread::hardware_concurrency());
+        return r;
+    }
+
+private:
+    // /proc/net/dev: "  eth0: rx_bytes packets ... (8개) tx_bytes ..."
+    static bool read_net_bytes(uint64_t &rx, uint64_t &tx) {
+        std::ifstream ifs("/proc/net/dev");
+        if (!ifs) return false;
+        std::string line;
+        while (std::getline(ifs, line)) {
+            std::size_t colon = line.find(':');
+            if (colon == std::string::npos) continue;
+            std::string name;
+            std::istringstream(line.substr(0, colon)) >> name;
+            if (name == "lo") continue;
+            std::istringstream in(line.substr(colon + 1));
+            uint64_t v[9] = {0};
+            for (auto &x : v) in >> x;
+            if (!in) continue;
+            rx += v[0];
+            tx += v[8];
+        }
+        return true;
+    }
 
-            json body;
-            body["host"] = host_for_master;
-            body["ctrlPort"] = cfg.bind_port;
-            body["name"] = cfg.node_name.empty() ? host_for_master : cfg.node_name;
+    std::vector<std::string> paths_;
+    uint64_t prev_rx_ = 0, prev_tx_ = 0;
+    std::chrono::steady_clock::time_point prev_time_;
+    bool have_prev_ = false;
+};
 
+// WORKER: 마스터에 등록하고 heartbeat_sec 마다 /api/heartbeat 를 보낸다.
+// 마스터가 이 노드를 모르면(404) 바로 다시 등록하고, 연결이 안 되면 1초부터 두 배씩
+// (최대 60초, ±20% 흔들림) 기다렸다 다시 등록한다. 워커가 한꺼번에 몰리지 않게 하기 위함.
+void worker_heartbeat_loop(const ControlConfig &cfg, StopFlag &stop) {
+    std::string host_for_master = cfg.public_host.empty() ? cfg.bind_host : cfg.public_host;
+    json body;
+    body["host"] = host_for_master;
+    body["ctrlPort"] = cfg.bind_port;
+    body["name"] = cfg.node_name.empty() ? host_for_master : cfg.node_name;
+    if (!cfg.zone.empty()) body["zone"] = cfg.zone;
+    double interval = std::max(1, cfg.heartbeat_sec);
+    double backoff = 1;
+    std::minstd_rand jitter((unsigned)std::hash<std::string>()(node_identity()) + (unsigned)cfg.bind_port);
+    bool registered = false;
+    ResourceSampler sampler(cfg.disk_paths);
+
+    while (true) {
+        double wait = interval;
+        body["resources"] = sampler.sample();
+        auto cli = ctrl_client(cfg.master_host, cfg.master_port);
+        cli.set_connection_timeout(3, 0);
+        cli.set_read_timeout(5, 0);
+        if (!registered) {
             std::cout << "[WORKER] 마스터 등록 시도 → "
                       << cfg.master_host << ":" << cfg.master_port
                       << " as " << host_for_master << ":" << cfg.bind_port << "\n";
-
             auto res2 = cli.Post("/api/register-node", body.dump(), "application/json");
             if (res2 && res2->status == 200) {
                 std::cout << "[WORKER] 마스터 등록 성공\n";
+                registered = true;
+                backoff = 1;
             } else {
+                wait = backoff * (0.8 + 0.4 * (jitter() % 1000) / 1000.0);
                 std::cout << "[WORKER] 마스터 등록 실패: "
-                          << (res2 ? std::to_string(res2->status) : "no response") << "\n";
+                          << (res2 ? std::to_string(res2->status) : "no response")
+                          << " (" << (int)wait << "s 후 재시도)\n";
+                backoff = std::min(backoff * 2, 60.0);
             }
-        } catch (const std::exception &e) {
-            std::cout << "[WORKER] 마스터 등록 예외: " << e.what() << "\n";
+        } else {
+            auto res2 = cli.Post("/api/heartbeat", body.dump(), "application/json");
+            if (!res2 || res2->status != 200) {
+                std::cout << "[WORKER] heartbeat 실패: "
+                          << (res2 ? std::to_string(res2->status) : "no response") << " → 재등록\n";
+                registered = false;
+                wait = res2 && res2->status == 404 ? 0 : backoff;
+            }
+        }
+        if (!stop.wait_for(wait)) break;
+    }
+}
+
+// MASTER: 소식이 끊긴 노드를 알리고 g_node_evict_sec 이 지나면 목록에서 지운다.
+// registry_file 이 있으면 목록이 바뀐 주기마다 스냅샷을 쓴다.
+void master_sweep_loop(StopFlag &stop, const fs::path &registry_file) {
+    std::set<std::string> stale;
+    double period = g_node_ttl_sec ? std::max<double>(1, g_node_ttl_sec / 2.0) : 30;
+    if (!registry_file.empty()) period = std::min(period, 10.0);
+    uint64_t saved_version = g_nodes.version();
+    while (stop.wait_for(period)) {
+        if (!registry_file.empty() && g_nodes.version() != saved_version) {
+            saved_version = g_nodes.version();
+            if (!save_registry(registry_file)) {
+                std::cout << "[MASTER] 노드 목록 저장 실패: " << registry_file << "\n";
+            }
+        }
+        uint64_t now = (uint64_t)std::time(nullptr);
+        for (auto &n : *g_nodes.snapshot()) {
+            std::string key = n->key();
+            uint64_t seen = n->last_seen.load();
+            if (!n->self && g_node_evict_sec && seen + g_node_evict_sec < now) {
+                // 스냅샷 뒤에 소식이 왔으면 remove_if_stale 이 지우지 않는다 (다음 주기에 다시 본다)
+                if (g_nodes.remove_if_stale(key, now - g_node_evict_sec)) {
+                    std::cout << "[MASTER] 노드 제거: " << key << " (" << now - seen << "s 무응답)\n";
+                    stale.erase(key);
+                }
+                continue;
+            }
+            if (node_alive(*n, now)) {
+                stale.erase(key);
+            } else if (stale.insert(key).second) {
+                std::cout << "[MASTER] 노드 응답 없음: " << key << " → send-all 에서 제외\n";
+                g_nodes.mark(key);
+            }
+        }
+    }
+}
+
+// ---------------- gossip membership ----------------
+// --gossip 모드: 마스터 없이 모든 컨트롤 서버가 SWIM 방식으로 서로의 생존을 확인하고
+// 멤버 목록을 퍼뜨린다. 각 노드의 g_nodes 가 같은 목록으로 수렴하므로 어느 노드에서든
+// /api/nodes, /api/send-all 을 쓸 수 있다.
+//  - 매 주기(--gossip-interval) 멤버 하나를 섞은 순서대로 골라 /api/gossip/ping.
+//    응답이 없으면 다른 멤버 k 개에게 대신 확인을 부탁하고(/api/gossip/ping-req), 모두 실패하면 suspect.
+//  - suspect 가 된 뒤 suspect 시간 안에 본인이 더 큰 incarnation 으로 반박하지 않으면 dead → g_nodes 에서 제거.
+//  - 상태 변화는 ping/응답에 얹어(piggyback) 약 3·log2(n) 번씩 퍼뜨린다.
+//  - 10 주기마다 멤버 하나와 전체 목록을 주고받아(/api/gossip/sync) 빠진 것을 메운다. 시작할 때는 --seeds 와 sync.
+// incarnation 은 시작 시각(초)으로 잡아, 재시작한 노드가 예전 dead 기록보다 우선하게 한다.
+// 자원 보고(ResourceSampler)는 ping 을 주고받는 두 노드 사이에서만 전해진다.
+enum class MemberState { ALIVE = 0, SUSPECT = 1, DEAD = 2 };
+
+const char *member_state_name(MemberState s) {
+    return s == MemberState::ALIVE ? "alive" : s == MemberState::SUSPECT ? "suspect" : "dead";
+}
+
+struct Member {
+    std::string host;
+    int port = 0;
+    std::string name;
+    std::string zone;
+    uint64_t incarnation = 0;
+    MemberState state = MemberState::ALIVE;
+    std::chrono::steady_clock::time_point since; // 이 상태가 된 때 (suspect/dead 만료용)
+
+    std::string key() const { return host + ":" + std::to_string(port); }
+
+    json to_json() const {
+        json j = {{"host", host}, {"ctrlPort", port}, {"name", name},
+                  {"incarnation", incarnation}, {"state", member_state_name(state)}};
+        if (!zone.empty()) j["zone"] = zone;
+        return j;
+    }
+
+    static bool from_json(const json &j, Member &m) {
+        m.host = j.value("host", "");
+        m.port = j.value("ctrlPort", 0);
+        m.name = j.value("name", "");
+        m.zone = j.value("zone", "");
+        m.incarnation = j.value("incarnation", (uint64_t)0);
+        std::string st = j.value("state", "alive");
+        m.state = st == "dead" ? MemberState::DEAD : st == "suspect" ? MemberState::SUSPECT : MemberState::ALIVE;
+        return !m.host.empty() && m.port > 0;
+    }
+};
+
+class Gossip {
+public:
+    static const int INDIRECT_PROBES = 3;
+    static const int SYNC_EVERY = 10;     // 주기
+    static const int PIGGYBACK_MAX = 16;  // 메시지 하나에 얹는 갱신 수
+
+    void start(const ControlConfig &cfg) {
+        self_.host = cfg.public_host.empty() ? cfg.bind_host : cfg.public_host;
+        self_.port = cfg.bind_port;
+        self_.name = cfg.node_name.empty() ? self_.host : cfg.node_name;
+        self_.zone = cfg.zone;
+        self_.incarnation = (uint64_t)std::time(nullptr);
+        self_.since = std::chrono::steady_clock::now();
+        seeds_ = cfg.seeds;
+        interval_ms_ = std::max(100, cfg.gossip_interval_ms);
+        suspect_ms_ = std::max(3 * interval_ms_, cfg.gossip_suspect_ms);
+        sampler_.reset(new ResourceSampler(cfg.disk_paths));
+        g_nodes.upsert(self_.host, self_.port, self_.name, (uint64_t)std::time(nullptr), true, self_.zone);
+        thread_ = std::thread([this]() { run(); });
+        std::cout << "[GOSSIP] 시작: " << self_.key() << " (seeds " << seeds_.size() << ")\n";
+    }
+
+    void stop() {
+        stop_.stop();
+        if (thread_.joinable()) thread_.join();
+    }
+
+    // /api/gossip/ping : 보낸 쪽과 얹어 온 갱신을 반영하고, 이쪽 갱신을 얹어 답한다
+    json on_ping(const json &body) {
+        merge_message(body);
+        return message();
+    }
+
+    // /api/gossip/ping-req : target 을 대신 ping 해 결과를 알려 준다
+    json on_ping_req(const json &body) {
+        merge_message(body);
+        json target = body.value("target", json::object());
+        json reply;
+        bool ok = ping(target.value("host", ""), target.value("ctrlPort", 0), &reply);
+        if (ok) merge_message(reply);
+        json r = message();
+        r["ok"] = ok;
+        return r;
+    }
+
+    // /api/gossip/sync : 전체 목록을 합치고 이쪽 전체 목록을 돌려준다
+    json on_sync(const json &body) {
+        merge_members(body);
+        json r;
+        r["from"] = self_json();
+        r["members"] = all_members();
+        return r;
+    }
+
+    json view() {
+        json r = json::array();
+        std::lock_guard<std::mutex> lk(mu_);
+        r.push_back(self_.to_json());
+        for (auto &kv : members_) r.push_back(kv.second.to_json());
+        return r;
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    void run() {
+        uint64_t round = 0;
+        join();
+        // 라운드 시작 간격이 interval 이 되도록 라운드에 쓴 시간만큼 덜 기다린다
+        double wait = interval_ms_ / 1000.0;
+        while (stop_.wait_for(wait)) {
+            auto t0 = Clock::now();
+            ++round;
+            probe_round();
+            expire();
+            if (round % SYNC_EVERY == 0 || no_peers()) sync_round();
+            refresh_registry();
+            double spent = std::chrono::duration<double>(Clock::now() - t0).count();
+            wait = std::max(0.0, interval_ms_ / 1000.0 - spent);
+        }
+    }
+
+    bool no_peers() {
+        std::lock_guard<std::mutex> lk(mu_);
+        for (auto &kv : members_) {
+            if (kv.second.state != MemberState::DEAD) return false;
+        }
+        return true;
+    }
+
+    void join() {
+        for (auto &seed : seeds_) {
+            std::size_t colon = seed.rfind(':');
+            if (colon == std::string::npos) continue;
+            std::string host = seed.substr(0, colon);
+            int port = std::atoi(seed.c_str() + colon + 1);
+            if (host + ":" + std::to_string(port) == self_.key()) continue;
+            if (sync_with(host, port)) {
+                std::cout << "[GOSSIP] 합류: " << seed << "\n";
+                return;
+            }
+        }
+    }
+
+    void sync_round() {
+        std::vector<Member> peers = pick(1, "");
+        if (peers.empty()) {
+            join();
+            return;
+        }
+        sync_with(peers[0].host, peers[0].port);
+    }
+
+    bool sync_with(const std::string &host, int port) {
+        auto cli = ctrl_client(host, port);
+        cli.set_connection_timeout(1, 0);
+        cli.set_read_timeout(3, 0);
+        json body;
+        body["from"] = self_json();
+        body["members"] = all_members();
+        auto res = cli.Post("/api/gossip/sync", body.dump(), "application/json");
+        if (!res || res->status != 200) return false;
+        try { merge_members(json::parse(res->body)); }
+        catch (...) { return false; }
+        return true;
+    }
+
+    void probe_round() {
+        Member target;
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            // 섞은 순서를 다 돌면 다시 섞는다 (모든 멤버가 주기적으로 확인되도록)
+            while (probe_idx_ < probe_order_.size() &&
+                   (!members_.count(probe_order_[probe_idx_]) ||
+                    members_[probe_order_[probe_idx_]].state == MemberState::DEAD)) {
+                ++probe_idx_;
+            }
+            if (probe_idx_ >= probe_order_.size()) {
+                probe_order_.clear();
+                for (auto &kv : members_) {
+                    if (kv.second.state != MemberState::DEAD) probe_order_.push_back(kv.first);
+                }
+                std::shuffle(probe_order_.begin(), probe_order_.end(), rng_);
+                probe_idx_ = 0;
+                if (probe_order_.empty()) return;
+            }
+            target = members_[probe_order_[probe_idx_++]];
+        }
+        // SWIM: 한 라운드는 interval 안에 끝낸다. 직접 ping 에 ping_timeout_ms() 를 쓰고,
+        // 남은 시간 동안 helper 들에게 동시에 ping-req 를 보내 첫 ack 가 오면 바로 끝낸다.
+        auto deadline = Clock::now() + std::chrono::milliseconds(interval_ms_);
+        json reply;
+        if (ping(target.host, target.port, &reply)) {
+            merge_message(reply);
+            return;
+        }
+        auto helpers = pick(INDIRECT_PROBES, target.key());
+        if (!helpers.empty() && indirect_ack(helpers, target, deadline)) return;
+        if (target.state == MemberState::ALIVE) {
+            target.state = MemberState::SUSPECT;
+            std::cout << "[GOSSIP] 응답 없음 → suspect: " << target.key() << "\n";
+            apply(target);
+        }
+    }
+
+    // helper 들의 ping-req 를 동시에 보내고 ack 하나가 오거나, 모두 실패하거나, deadline 이 되면 돌아온다.
+    // 늦게 끝나는 요청은 분리된 스레드가 마무리한다 (각 요청도 deadline 을 넘지 않는다).
+    bool indirect_ack(const std::vector<Member> &helpers, const Member &target, Clock::time_point deadline) {
+        struct Wait {
+            std::mutex mu;
+            std::condition_variable cv;
+            std::size_t pending;
+            bool ack = false;
+        };
+        auto w = std::make_shared<Wait>();
+        w->pending = helpers.size();
+        json body = message();
+        body["target"] = {{"host", target.host}, {"ctrlPort", target.port}};
+        std::string payload = body.dump();
+        for (auto &helper : helpers) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now());
+            left = std::max(left, std::chrono::milliseconds(10));
+            std::thread([this, w, helper, payload, left]() {
+                bool ok = false;
+                auto cli = ctrl_client(helper.host, helper.port);
+                cli.set_connection_timeout(left);
+                cli.set_read_timeout(left);
+                auto res = cli.Post("/api/gossip/ping-req", payload, "application/json");
+                if (res && res->status == 200) {
+                    try {
+                        json r = json::parse(res->body);
+                        merge_message(r);
+                        ok = r.value("ok", false);
+                    } catch (...) {}
+                }
+                std::lock_guard<std::mutex> lk(w->mu);
+                w->pending--;
+                w->ack = w->ack || ok;
+                w->cv.notify_all();
+            }).detach();
+        }
+        std::unique_lock<std::mutex> lk(w->mu);
+        w->cv.wait_until(lk, deadline, [&]() { return w->ack || w->pending == 0; });
+        return w->ack;
+    }
+
+    // 직접 ping 제한 시간: 라운드의 1/3 (나머지는 간접 확인에 남긴다)
+    int ping_timeout_ms() const { return std::min(1000, std::max(50, interval_ms_ / 3)); }
+
+    bool ping(const std::string &host, int port, json *reply) {
+        if (host.empty() || port <= 0) return false;
+        auto cli = ctrl_client(host, port);
+        cli.set_connection_timeout(std::chrono::milliseconds(ping_timeout_ms()));
+        cli.set_read_timeout(std::chrono::milliseconds(ping_timeout_ms()));
+        auto res = cli.Post("/api/gossip/ping", message().dump(), "application/json");
+        if (!res || res->status != 200) return false;
+        try { *reply = json::parse(res->body); }
+        catch (...) { return false; }
+        return true;
+    }
+
+    // suspect 가 오래되면 dead, dead 는 한동안 기억했다가 (늦게 도착한 예전 alive 를 막기 위해) 지운다
+    void expire() {
+        auto now = Clock::now();
+        std::vector<Member> dead;
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            for (auto it = members_.begin(); it != members_.end();) {
+                auto age = std::chrono::duration_cast<std::chrono::milliseconds>(now - it->second.since).count();
+                if (it->second.state == MemberState::SUSPECT && age > suspect_ms_) {
+                    Member m = it->second;
+                    m.state = MemberState::DEAD;
+                    dead.push_back(m);
+                } else if (it->second.state == MemberState::DEAD && age > 60 * 1000) {
+                    it = members_.erase(it);
+                    continue;
+                }
+                ++it;
+            }
+        }
+        for (auto &m : dead) {
+            std::cout << "[GOSSIP] dead: " << m.key() << "\n";
+            apply(m);
+        }
+    }
+
+    // 살아 있는 멤버의 last_seen 을 갱신해 send-all 의 liveness 판단(node_alive)과 맞춘다
+    void refresh_registry() {
+        uint64_t now = (uint64_t)std::time(nullptr);
+        std::vector<std::string> alive;
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            for (auto &kv : members_) {
+                if (kv.second.state == MemberState::ALIVE) alive.push_back(kv.first);
+            }
+        }
+        for (auto &k : alive) {
+            std::size_t colon = k.rfind(':');
+            g_nodes.touch(k.substr(0, colon), std::atoi(k.c_str() + colon + 1), now);
+        }
+    }
+
+    // exclude 와 자신을 뺀 살아 있는 멤버 중 n 개를 무작위로
+    std::vector<Member> pick(std::size_t n, const std::string &exclude) {
+        std::vector<Member> out;
+        std::lock_guard<std::mutex> lk(mu_);
+        for (auto &kv : members_) {
+            if (kv.second.state == MemberState::ALIVE && kv.first != exclude) out.push_back(kv.second);
+        }
+        std::shuffle(out.begin(), out.end(), rng_);
+        if (out.size() > n) out.resize(n);
+        return out;
+    }
+
+    json self_json() {
+        json j;
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            j = self_.to_json();
+        }
+        std::lock_guard<std::mutex> lk(sample_mu_);
+        j["resources"] = sampler_->sample();
+        return j;
+    }
+
+    json all_members() {
+        json arr = json::array();
+        std::lock_guard<std::mutex> lk(mu_);
+        for (auto &kv : members_) arr.push_back(kv.second.to_json());
+        return arr;
+    }
+
+    // ping/응답 본문: { from, updates[] }
+    json message() {
+        json j;
+        j["from"] = self_json();
+        j["updates"] = json::array();
+        std::lock_guard<std::mutex> lk(mu_);
+        std::size_t limit = 3 * (std::size_t)std::ceil(std::log2((double)members_.size() + 2));
+        int n = 0;
+        for (auto it = updates_.begin(); it != updates_.end() && n < PIGGYBACK_MAX; ++n) {
+            j["updates"].push_back(it->first.to_json());
+            if (++it->second >= limit) it = updates_.erase(it);
+            else ++it;
+        }
+        return j;
+    }
+
+    void merge_message(const json &j) {
+        Member from;
+        if (j.contains("from") && Member::from_json(j["from"], from)) {
+            from.state = MemberState::ALIVE; // 말을 걸어 왔으면 살아 있다
+            apply(from);
+            {
+                // 아직 suspect/dead 로 보고 있으면 그 소문을 답에 다시 얹어 본인이 반박하게 한다
+                std::lock_guard<std::mutex> lk(mu_);
+                auto it = members_.find(from.key());
+                if (it != members_.end() && it->second.state != MemberState::ALIVE) queue(it->second);
+            }
+            auto res = heartbeat_resources(j["from"]);
+            if (res) g_nodes.touch(from.host, from.port, (uint64_t)std::time(nullptr), nullptr, res);
+        }
+        if (j.contains("updates") && j["updates"].is_array()) {
+            for (auto &u : j["updates"]) {
+                Member m;
+                if (Member::from_json(u, m)) apply(m);
+            }
+        }
+    }
+
+    void merge_members(const json &j) {
+        merge_message(j);
+        if (!j.contains("members") || !j["members"].is_array()) return;
+        for (auto &u : j["members"]) {
+            Member m;
+            if (Member::from_json(u, m)) apply(m);
+        }
+    }
+
+    // SWIM 우선순위: incarnation 이 크면 이기고, 같으면 alive < suspect < dead 순으로 이긴다
+    void apply(Member m) {
+        m.since = Clock::now();
+        std::string key = m.key();
+        std::lock_guard<std::mutex> lk(mu_);
+        if (key == self_.key()) {
+            // 나에 대한 suspect/dead 소문은 incarnation 을 올려 반박한다
+            if (m.state != MemberState::ALIVE && m.incarnation >= self_.incarnation) {
+                self_.incarnation = m.incarnation + 1;
+                std::cout << "[GOSSIP] 반박: incarnation " << self_.incarnation << "\n";
+                queue(self_);
+            }
+            return;
+        }
+        auto it = members_.find(key);
+        if (it != members_.end()) {
+            const Member &cur = it->second;
+            bool newer = m.incarnation > cur.incarnation ||
+                         (m.incarnation == cur.incarnation && (int)m.state > (int)cur.state);
+            if (!newer) return;
+            if (m.name.empty()) m.name = cur.name;
+            if (cur.state == m.state && m.state == MemberState::ALIVE) {
+                it->second = m; // incarnation 만 오른 alive (반박): 목록은 그대로
+                queue(m);
+                return;
+            }
+        } else if (m.state != MemberState::ALIVE) {
+            // 모르는 노드의 suspect/dead 는 기록만 (늦게 온 예전 alive 를 막는다)
+            members_[key] = m;
+            return;
+        }
+        bool added = it == members_.end();
+        members_[key] = m;
+        queue(m);
+        uint64_t now = (uint64_t)std::time(nullptr);
+        if (m.state == MemberState::DEAD) {
+            g_nodes.remove(key);
+        } else if (m.state == MemberState::SUSPECT) {
+            g_nodes.mark(key);
+        } else {
+            g_nodes.upsert(m.host, m.port, m.name, now, false, m.zone);
+            if (added) std::cout << "[GOSSIP] 멤버 추가: " << key << " (" << m.name << ")\n";
+            else g_nodes.mark(key);
+        }
+    }
+
+    void queue(const Member &m) {
+        for (auto it = updates_.begin(); it != updates_.end(); ++it) {
+            if (it->first.key() == m.key()) {
+                updates_.erase(it);
+                break;
+            }
+        }
+        updates_.emplace_front(m, 0);
+    }
+
+    std::mutex mu_;
+    Member self_;
+    std::map<std::string, Member> members_;
+    std::deque<std::pair<Member, std::size_t>> updates_; // (갱신, 보낸 횟수)
+    std::vector<std::string> probe_order_;
+    std::size_t probe_idx_ = 0;
+    std::minstd_rand rng_{std::random_device{}()};
+
+    std::mutex sample_mu_;
+    std::unique_ptr<ResourceSampler> sampler_;
+    std::vector<std::string> seeds_;
+    int interval_ms_ = 1000;
+    int suspect_ms_ = 5000;
+    StopFlag stop_;
+    std::thread thread_;
+};
+
+Gossip g_gossip;
+
+void register_gossip_routes(httplib::Server &svr) {
+    auto route = [&svr](const char *path, json (Gossip::*fn)(const json &)) {
+        svr.Post(path, [fn](const httplib::Request &req, httplib::Response &res) {
+            try {
+                res.set_content((g_gossip.*fn)(json::parse(req.body)).dump(), "application/json");
+            } catch (...) {
+                res.status = 400;
+                res.set_content("{\"error\":\"invalid json\"}", "application/json");
+            }
+        });
+    };
+    route("/api/gossip/ping", &Gossip::on_ping);
+    route("/api/gossip/ping-req", &Gossip::on_ping_req);
+    route("/api/gossip/sync", &Gossip::on_sync);
+    svr.Get("/api/gossip/members", [](const httplib::Request &, httplib::Response &res) {
+        res.set_content(g_gossip.view().dump(), "application/json");
+    });
+}
+
+void start_control_server(const ControlConfig &cfg) {
+    httplib::Server svr;
+    // send-file 은 스케줄러 대기 중 핸들러 스레드를 붙잡고 있으므로
+    // 기본 풀(코어 수)보다 넉넉하게 잡아 download-file 등이 굶지 않게 한다.
+    int ctrl_threads = std::max(cfg.ctrl_threads, (int)CPPHTTPLIB_THREAD_POOL_COUNT);
+    svr.new_task_queue = [ctrl_threads] { return new httplib::ThreadPool((size_t)ctrl_threads); };
+    // keep-alive 로 register/heartbeat 를 연달아 보내는 클라이언트가 응답마다 Nagle 지연을 먹지 않게
+    svr.set_tcp_nodelay(true);
+    g_scheduler.configure(cfg.max_transfers, cfg.max_transfer_bytes);
+    g_node_send_limiter.set_rate(cfg.node_rate_limit);
+    g_node_recv_limiter.set_rate(cfg.node_rate_limit);
+    g_target_rate_default = cfg.target_rate_limit;
+    g_data_ports.configure(cfg.data_port_lo, cfg.data_port_hi);
+    g_node_ttl_sec = (uint64_t)std::max(0, cfg.node_ttl_sec);
+    g_node_evict_sec = (uint64_t)std::max(0, cfg.node_evict_sec);
+
+    std::cout << "\n[CONTROL] 서버 시작"
+              << "\n  bind: " << cfg.bind_host << ":" << cfg.bind_port
+              << "\n  mode: " << (cfg.gossip ? "GOSSIP" : cfg.is_master ? "MASTER" :
+                                  (cfg.master_host.empty() ? "STANDALONE" : "WORKER"))
+              << "\n  limit: transfers=" << cfg.max_transfers
+              << " bytes=" << cfg.max_transfer_bytes
+              << std::endl;
+
+    if (cfg.is_master) {
+        std::string self_host = cfg.public_host.empty() ? cfg.bind_host : cfg.public_host;
+        g_nodes.upsert(self_host, cfg.bind_port, cfg.node_name.empty() ? "master" : cfg.node_name,
+                       (uint64_t)std::time(nullptr), true, cfg.zone);
+        std::cout << "[MASTER] 자기 자신 등록: " << self_host << ":" << cfg.bind_port << "\n";
+        if (!cfg.registry_file.empty() && file_exists(cfg.registry_file)) {
+            std::size_t n = load_registry(cfg.registry_file);
+            std::cout << "[MASTER] 저장된 노드 " << n << "개 복원 (heartbeat 전까지 unverified)\n";
+        }
+    }
+
+    register_control_routes(svr, cfg);
+
+    // 같은 머신의 노드/CLI 용 unix domain socket 리스너 (--uds-dir). 라우트는 TCP 와 같다.
+    httplib::Server uds_svr;
+    std::thread uds_thread;
+    if (!g_uds_dir.empty()) {
+        ensure_dir(g_uds_dir);
+        fs::path sock = g_uds_dir / ("ctrl-" + std::to_string(cfg.bind_port) + ".sock");
+        uds_svr.new_task_queue = [ctrl_threads] { return new httplib::ThreadPool((size_t)ctrl_threads); };
+        register_control_routes(uds_svr, cfg);
+        if (listen_unix(uds_svr, sock)) {
+            g_ctrl_socket = sock.string();
+            uds_thread = std::thread([&uds_svr]() { uds_svr.listen_after_bind(); });
+            std::cout << "[CONTROL] unix socket: " << sock << "\n";
+        } else {
+            std::cout << "[CONTROL] unix socket 실패: " << sock << "\n";
         }
     }
 
+    // WORKER: 마스터 등록 + heartbeat, MASTER: 오래된 노드 정리
+    StopFlag bg_stop;
+    std::thread bg_thread;
+    if (!cfg.is_master && !cfg.master_host.empty()) {
+        bg_thread = std::thread([&cfg, &bg_stop]() { worker_heartbeat_loop(cfg, bg_stop); });
+    } else if ((cfg.is_master || cfg.gossip) &&
+               (g_node_ttl_sec || g_node_evict_sec || !cfg.registry_file.empty())) {
+        bg_thread = std::thread([&cfg, &bg_stop]() { master_sweep_loop(bg_stop, cfg.registry_file); });
+    }
+
+    if (cfg.gossip) {
+        register_gossip_routes(svr);
+        g_gossip.start(cfg);
+    }
+
     svr.listen(cfg.bind_host.c_str(), cfg.bind_port);
+    if (cfg.gossip) g_gossip.stop();
+    bg_stop.stop();
+    if (bg_thread.joinable()) bg_thread.join();
+    if (cfg.is_master && !cfg.registry_file.empty()) save_registry(cfg.registry_file);
+    if (uds_thread.joinable()) {
+        uds_svr.stop();
+        uds_thread.join();
+    }
 }
 
 // ---------------- SEND (1:1) ----------------
@@ -855,7 +6251,7 @@ void start_send(const SendConfig &cfg) {
               << "\n  file: " << cfg.source_file
               << "\n";
 
-    httplib::Client cli(cfg.source_host.c_str(), cfg.source_ctrl_port);
+    auto cli = ctrl_client(cfg.source_host, cfg.source_ctrl_port);
     cli.set_read_timeout(300, 0);
 
     json body;
@@ -867,12 +6263,41 @@ void start_send(const SendConfig &cfg) {
     body["targetSave"] = cfg.target_save;
     body["progress"] = cfg.progress;
     body["autoExtract"] = cfg.auto_extract;
+    body["priority"] = cfg.priority;
+    if (cfg.rate_limit) body["rateLimit"] = cfg.rate_limit;
+    if (cfg.target_rate_limit) body["targetRateLimit"] = cfg.target_rate_limit;
+    if (cfg.batch_size) body["batchSize"] = cfg.batch_size;
+    if (cfg.connections) body["connections"] = cfg.connections;
+    if (cfg.parallel) body["parallel"] = cfg.parallel;
+    if (cfg.bundle) body["bundle"] = true;
+    if (cfg.bundle_threshold) body["bundleThreshold"] = cfg.bundle_threshold;
+    if (!cfg.result_mode.empty()) body["resultMode"] = cfg.result_mode;
+    if (cfg.sync) body["sync"] = true;
+    if (cfg.sync_hash) body["syncHash"] = true;
+    if (cfg.no_hardlinks) body["hardlinks"] = false;
+    if (cfg.dedupe) body["dedupe"] = true;
+    if (cfg.no_local_copy) body["localCopy"] = false;
+    if (!cfg.transport.empty()) body["transport"] = cfg.transport;
+    if (cfg.cas) body["cas"] = true;
 
     if (cfg.pack_mode == PackMode::TAR) body["packMode"] = "tar";
     else if (cfg.pack_mode == PackMode::GZ) body["packMode"] = "gz";
     else if (cfg.pack_mode == PackMode::TARGZ) body["packMode"] = "targz";
     else body["packMode"] = "none";
 
+    if (cfg.result_mode == "stream") {
+        // NDJSON 결과를 받는 대로 출력
+        auto res = cli.Post("/api/send-file", httplib::Headers(), body.dump(), "application/json",
+            [](const char *data, size_t len) {
+                std::cout.write(data, (std::streamsize)len);
+                std::cout.flush();
+                return true;
+            });
+        if (!res) std::cerr << "[SEND] no response\n";
+        else std::cout << "[SEND] status: " << res->status << std::endl;
+        return;
+    }
+
     auto res = cli.Post("/api/send-file", body.dump(), "application/json");
     if (!res) {
         std::cerr << "[SEND] no response\n";
@@ -890,7 +6315,7 @@ void start_send_all(const SendAllConfig &cfg) {
               << "\n  file  : " << cfg.source_file
               << "\n";
 
-    httplib::Client cli(cfg.master_host.c_str(), cfg.master_port);
+    auto cli = ctrl_client(cfg.master_host, cfg.master_port);
     cli.set_read_timeout(300, 0);
 
     json body;
@@ -901,6 +6326,25 @@ void start_send_all(const SendAllConfig &cfg) {
     body["targetSave"] = cfg.target_save;
     body["progress"] = cfg.progress;
     body["autoExtract"] = cfg.auto_extract;
+    body["priority"] = cfg.priority;
+    if (cfg.rate_limit) body["rateLimit"] = cfg.rate_limit;
+    if (cfg.target_rate_limit) body["targetRateLimit"] = cfg.target_rate_limit;
+    if (cfg.batch_size) body["batchSize"] = cfg.batch_size;
+    if (cfg.connections) body["connections"] = cfg.connections;
+    if (cfg.parallel) body["parallel"] = cfg.parallel;
+    if (cfg.bundle) body["bundle"] = true;
+    if (cfg.bundle_threshold) body["bundleThreshold"] = cfg.bundle_threshold;
+    if (!cfg.result_mode.empty()) body["resultMode"] = cfg.result_mode;
+    if (cfg.sync) body["sync"] = true;
+    if (cfg.sync_hash) body["syncHash"] = true;
+    if (cfg.no_hardlinks) body["hardlinks"] = false;
+    if (cfg.dedupe) body["dedupe"] = true;
+    if (cfg.no_local_copy) body["localCopy"] = false;
+    if (!cfg.transport.empty()) body["transport"] = cfg.transport;
+    if (cfg.cas) body["cas"] = true;
+    if (cfg.skip_present) body["skipPresent"] = true;
+    if (cfg.no_load_aware) body["loadAware"] = false;
+    if (cfg.topology) body["topology"] = true;
 
     if (cfg.pack_mode == PackMode::TAR) body["packMode"] = "tar";
     else if (cfg.pack_mode == PackMode::GZ) body["packMode"] = "gz";
@@ -945,6 +6389,9 @@ int main(int argc, char **argv) {
         auto it = args.find(k);
         return it == args.end() ? def : it->second;
     };
+    g_uds_dir = get("uds-dir", "");
+    g_cas_dir = get("cas-dir", "");
+    g_cas_hardlink = has("cas-hardlink");
 
     if (has("control")) {
         ControlConfig cfg;
@@ -955,6 +6402,32 @@ int main(int argc, char **argv) {
         cfg.master_port = std::stoi(get("master-port", "7000"));
         cfg.public_host = get("node-host", get("public-host", ""));
         cfg.node_name = get("node-name", "");
+        cfg.zone = get("zone", "");
+        cfg.ctrl_threads = std::stoi(get("ctrl-threads", "64"));
+        cfg.max_transfers = std::stoi(get("max-transfers", "0"));
+        cfg.max_transfer_bytes = parse_size(get("max-transfer-bytes", "0"));
+        cfg.node_rate_limit = parse_size(get("node-rate-limit", "0"));
+        cfg.target_rate_limit = parse_size(get("target-rate-limit", "0"));
+        cfg.disk_paths = split_list(get("disk-paths", ""));
+        cfg.gossip = has("gossip");
+        cfg.registry_file = get("registry-file", "");
+        cfg.seeds = split_list(get("seeds", ""));
+        cfg.gossip_interval_ms = std::stoi(get("gossip-interval", "1000"));
+        cfg.gossip_suspect_ms = std::stoi(get("gossip-suspect", "5000"));
+        cfg.heartbeat_sec = std::stoi(get("heartbeat-sec", "10"));
+        cfg.node_ttl_sec = std::stoi(get("node-ttl", "30"));
+        cfg.node_evict_sec = std::stoi(get("node-evict", "600"));
+        std::string range = get("data-port-range", "");
+        if (!range.empty()) {
+            std::size_t dash = range.find('-');
+            cfg.data_port_lo = std::stoi(range.substr(0, dash));
+            cfg.data_port_hi = dash == std::string::npos ? cfg.data_port_lo
+                                                         : std::stoi(range.substr(dash + 1));
+            if (cfg.data_port_hi < cfg.data_port_lo) {
+                std::cerr << "Error: --data-port-range 형식은 LO-HI\n";
+                return 1;
+            }
+        }
         start_control_server(cfg);
         return 0;
     }
@@ -983,6 +6456,22 @@ int main(int argc, char **argv) {
         cfg.target_save = get("target-save", get("client-save", ""));
         cfg.send_port = std::stoi(get("send-port", "9000"));
         cfg.progress = progress;
+        cfg.priority = get("priority", "normal");
+        cfg.rate_limit = parse_size(get("rate-limit", "0"));
+        cfg.target_rate_limit = parse_size(get("target-rate-limit", "0"));
+        cfg.batch_size = std::stoi(get("batch-size", "0"));
+        cfg.connections = std::stoi(get("connections", "0"));
+        cfg.parallel = std::stoi(get("parallel", "0"));
+        cfg.bundle = has("bundle");
+        cfg.bundle_threshold = parse_size(get("bundle-threshold", "0"));
+        cfg.result_mode = get("result-mode", "");
+        cfg.sync = has("sync");
+        cfg.sync_hash = has("sync-hash");
+        cfg.no_hardlinks = has("no-hardlinks");
+        cfg.dedupe = has("dedupe");
+        cfg.no_local_copy = has("no-local-copy");
+        cfg.cas = has("cas");
+        cfg.transport = get("transport", "");
 
         if (cfg.source_file.empty()) {
             std::cerr << "Error: --source-file 또는 -f 필요\n";
@@ -1015,6 +6504,25 @@ int main(int argc, char **argv) {
         cfg.send_port = std::stoi(get("send-port", "9000"));
         cfg.target_save = get("target-save", get("client-save", ""));
         cfg.progress = progress;
+        cfg.priority = get("priority", "normal");
+        cfg.rate_limit = parse_size(get("rate-limit", "0"));
+        cfg.target_rate_limit = parse_size(get("target-rate-limit", "0"));
+        cfg.batch_size = std::stoi(get("batch-size", "0"));
+        cfg.connections = std::stoi(get("connections", "0"));
+        cfg.parallel = std::stoi(get("parallel", "0"));
+        cfg.bundle = has("bundle");
+        cfg.bundle_threshold = parse_size(get("bundle-threshold", "0"));
+        cfg.result_mode = get("result-mode", "");
+        cfg.sync = has("sync");
+        cfg.sync_hash = has("sync-hash");
+        cfg.no_hardlinks = has("no-hardlinks");
+        cfg.dedupe = has("dedupe");
+        cfg.no_local_copy = has("no-local-copy");
+        cfg.cas = has("cas");
+        cfg.skip_present = has("skip-present");
+        cfg.no_load_aware = has("no-load-aware");
+        cfg.topology = has("topology");
+        cfg.transport = get("transport", "");
 
         if (cfg.master_host.empty()) {
             std::cerr << "Error: --master-host 필요\n";
@@ -1071,17 +6579,61 @@ int main(int argc, char **argv) {
     --master-host      워커 모드일 때 마스터 IP
     --master-port      마스터 컨트롤 포트 (기본 7000)
     --node-host        다른 노드가 접근할 IP (공개 IP)
+    --zone             노드 위치 라벨 "dc/rack" ('/' 로 단계 구분). send-all --topology 가 쓴다
     -p, --port         컨트롤 포트 (기본 7000)
     -h, --host         바인딩 IP (기본 0.0.0.0)
+    --max-transfers    동시 실행 전송 수 상한 (기본 0 = 무제한)
+    --max-transfer-bytes  동시 실행 전송 바이트 합 상한 (예: 20G, 기본 무제한)
+    --ctrl-threads     컨트롤 서버 워커 스레드 수 (기본 64)
+    --node-rate-limit  노드 전체 송신/수신 대역폭 상한 (bytes/s, 예: 100M)
+    --target-rate-limit 대상 호스트별 송신 대역폭 상한 (bytes/s)
+    --heartbeat-sec    워커 → 마스터 heartbeat 주기 (기본 10). 실패하면 backoff 후 재등록
+    --node-ttl         마스터: 이 초 동안 heartbeat 없는 노드는 send-all 에서 제외 (기본 30, 0 = 끔)
+    --node-evict       마스터: 이 초 동안 heartbeat 없는 노드는 목록에서 제거 (기본 600, 0 = 끔)
+    --disk-paths       heartbeat 에 남은 용량을 보고할 경로들 (쉼표 구분. cwd, --cas-dir 는 항상 보고)
+    --registry-file    마스터: 노드 목록을 이 파일에 주기적으로 저장하고 시작할 때 다시 읽는다.
+                       읽어 온 노드는 heartbeat 가 올 때까지 verified: false. 저장된 lastSeen 을 그대로 써서
+                       node-ttl 이 지난 노드는 stale, node-evict 가 지난 노드는 버린다
+    --gossip           마스터 없이 SWIM gossip 으로 멤버 목록 유지. 모든 노드에서 /api/nodes,
+                       /api/send-all 사용 가능 (--node-host 에 다른 노드가 접근할 주소 필요)
+    --seeds            gossip 합류할 노드들 host:port (쉼표 구분)
+    --gossip-interval  gossip 확인 주기 ms (기본 1000)
+    --gossip-suspect   suspect 후 dead 로 보기까지 ms (기본 5000)
+    --data-port-range  데이터 서버 포트 범위 (예: 9000-9100). 없으면 요청 포트,
+                       사용 중이면 임시 포트로 대체
+    --uds-dir          unix socket 디렉토리. 컨트롤 서버가 <dir>/ctrl-<port>.sock 에서도 듣고,
+                       같은 머신 대상으로는 데이터도 unix socket 으로 보낸다
+                       (--send/--send-all 에 주면 같은 머신 노드에 socket 으로 접속)
+    --cas-dir          내용 저장소 디렉토리. 받은 파일(64K 이상)을 SHA-256 으로 모아 두고,
+                       같은 내용을 다시 받으면 네트워크 대신 reflink/복사로 꺼낸다.
+                       GET /api/cas/<sha256> 로 다른 노드에 내보낸다
+    --cas-hardlink     reflink 가 안 될 때 저장소에 복사 대신 받은 파일의 hardlink 를 넣는다
+                       (디스크 절약. 받은 파일을 제자리에서 고치면 그 항목은 버려진다)
 
   --send               1:1 전송
     --source-host      소스 컨트롤 호스트
     --source-port      소스 컨트롤 포트
     --source-file, -f  전송할 파일/폴더
-    --send-port        데이터 서버 포트 (기본 9000)
+    --send-port        데이터 서버 포트 (기본 9000, 0 = 임시 포트)
     --target-host      대상 컨트롤 호스트
     --target-port      대상 컨트롤 포트
     --target-save      대상 저장 디렉토리
+    --priority         urgent | high | normal | bulk | 정수 (기본 normal)
+    --rate-limit       이 전송의 대역폭 상한 (bytes/s, 예: 50M)
+    --target-rate-limit 소스에서 이 대상으로 가는 송신 상한 (bytes/s)
+    --batch-size       RAW 폴더 전송 시 배치당 파일 수 (기본 1000)
+    --connections      RAW 배치 수신 연결 수 (기본 4, 최대 16)
+    --parallel         RAW 폴더 동시 전송 워커 수 (기본 4, 최대 32)
+    --bundle           RAW 폴더의 작은 파일을 묶음 프레임으로 전송
+    --bundle-threshold 묶음 대상 파일 크기 상한 (기본 64K)
+    --result-mode      RAW 폴더 결과 형식: full(기본) | summary(합계+실패만) | stream(NDJSON)
+    --sync             RAW 폴더: 대상에 경로/크기/mtime 이 같은 파일이 있으면 건너뜀
+    --sync-hash        RAW 폴더: 경로/크기/내용(SHA-256) 으로 비교해 건너뜀
+    --no-hardlinks     RAW 폴더: hardlink 를 감지하지 않고 각각 전송
+    --dedupe           RAW 폴더: 내용이 같은 파일은 한 번만 보내고 대상에서 복사
+    --no-local-copy    대상이 같은 머신이어도 로컬 복사(reflink/copy_file_range) 대신 네트워크 전송
+    --transport        같은 머신 대상 전송 방식: auto(기본) | copy | uds | shm(memfd 링) | tcp
+    --cas              파일/묶음 전송 시 SHA-256 을 함께 보내 대상 저장소(--cas-dir)에 있으면 재사용
 
   --send-all           마스터를 통한 브로드캐스트
     --master-host      마스터 호스트
@@ -1091,6 +6643,23 @@ int main(int argc, char **argv) {
     --source-file, -f  전송할 파일/폴더
     --send-port        데이터 서버 포트
     --target-save      대상들이 저장할 디렉토리
+    --priority         소스 노드 스케줄러 우선순위
+    --rate-limit       대상별 전송 하나당 대역폭 상한
+    --target-rate-limit 소스에서 대상 호스트별 송신 상한
+    --batch-size, --connections, --parallel, --bundle, --bundle-threshold  (1:1 과 동일)
+    --result-mode      대상별 RAW 결과 형식 (stream 은 summary 로 전달)
+    --sync, --sync-hash 대상별로 이미 있는 파일 건너뛰기 (1:1 과 동일)
+    --no-hardlinks, --dedupe  hardlink/중복 내용 처리 (1:1 과 동일)
+    --no-local-copy    같은 머신 대상도 네트워크로 전송 (1:1 과 동일)
+    --transport        같은 머신 대상 전송 방식 (1:1 과 동일)
+    --cas              대상 저장소 재사용 (1:1 과 동일, 해시는 소스에서 한 번만 계산)
+    --skip-present     targetSave 에 크기/SHA-256 이 같은 파일이 이미 있는 대상은 보내지 않음
+                       (그대로 보내는 단일 파일만. 결과에 skipped 로 표시)
+    --no-load-aware    노드 자원 보고(디스크/부하/전송 수)로 대상 순서를 정하고
+                       자리 없는 노드를 건너뛰는 동작 끄기
+    --topology         소스가 zone(dc/rack)마다 한 노드에만 보내고 그 노드가 같은 zone 에 다시 보냄.
+                       zone 없는 노드는 /api/measure 결과가 있으면 더 빠른 경로로 중계
+                       (그대로 보내는 파일/RAW 폴더만. 결과의 from 이 실제로 보낸 노드)
 
   -t                   tar
   -g                   gz (파일: .gz, 폴더: tar.gz)